@@ -0,0 +1,509 @@
+#ifndef BASICTHREADPOOL_H
+#define BASICTHREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "runnable.h"
+
+/*
+ * Fixed-size pool whose queue, idle strategy and task representation are
+ * chosen at compile time. None of ThreadPool's runtime machinery (pimpl,
+ * thread expiry, deadlines, hooks, statistics) is involved, so with
+ * FifoQueue and FunctionPointerTask the submit and dispatch paths are a
+ * few inlined calls around a mutex-protected deque.
+ *
+ * A task that throws terminates the program, as with std::thread.
+ *
+ * Queue policies provide `template<typename Task> class type` with
+ * type(workers), push(task, priority, worker), pop(task, worker) and
+ * size(); `worker` is npos for threads outside the pool. Wait policies
+ * provide wait(ready), notifyOne() and notifyAll(). Task policies provide
+ * `type` and run(type&).
+ */
+
+struct FifoQueue {
+	template<typename Task>
+	class type {
+	public:
+		explicit type(std::size_t) {}
+
+		void push(Task&& task, int, std::size_t)
+		{
+			const std::lock_guard<std::mutex> locker(this->m_mutex);
+			this->m_tasks.push_back(std::move(task));
+			this->m_size.fetch_add(1, std::memory_order_seq_cst);
+		}
+
+		bool pop(Task& task, std::size_t)
+		{
+			const std::lock_guard<std::mutex> locker(this->m_mutex);
+			if (this->m_tasks.empty()) {
+				return false;
+			}
+
+			task = std::move(this->m_tasks.front());
+			this->m_tasks.pop_front();
+			this->m_size.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		std::size_t size() const noexcept { return this->m_size.load(std::memory_order_seq_cst); }
+
+	private:
+		std::mutex m_mutex;
+		std::deque<Task> m_tasks;
+		std::atomic<std::size_t> m_size{0};
+	};
+};
+
+// Highest priority first, FIFO within a priority level
+struct PriorityQueue {
+	template<typename Task>
+	class type {
+	public:
+		explicit type(std::size_t) {}
+
+		void push(Task&& task, int priority, std::size_t)
+		{
+			const std::lock_guard<std::mutex> locker(this->m_mutex);
+			this->m_buckets[priority].push_back(std::move(task));
+			this->m_size.fetch_add(1, std::memory_order_seq_cst);
+		}
+
+		bool pop(Task& task, std::size_t)
+		{
+			const std::lock_guard<std::mutex> locker(this->m_mutex);
+			auto it = this->m_buckets.begin();
+			if (it == this->m_buckets.end()) {
+				return false;
+			}
+
+			task = std::move(it->second.front());
+			it->second.pop_front();
+			if (it->second.empty()) {
+				this->m_buckets.erase(it);
+			}
+
+			this->m_size.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		std::size_t size() const noexcept { return this->m_size.load(std::memory_order_seq_cst); }
+
+	private:
+		std::mutex m_mutex;
+		std::map<int, std::deque<Task>, std::greater<int> > m_buckets;
+		std::atomic<std::size_t> m_size{0};
+	};
+};
+
+/*
+ * One deque per worker: a worker pushes to and pops from the back of its
+ * own deque (most recent, cache-hot task first) and steals from the front
+ * of the others when it runs dry. Outside submissions are spread round
+ * robin. Priorities are ignored.
+ */
+struct WorkStealingQueue {
+	template<typename Task>
+	class type {
+	public:
+		explicit type(std::size_t workers)
+			: m_slots(new Slot[std::max<std::size_t>(workers, 1)]), m_count(std::max<std::size_t>(workers, 1))
+		{
+		}
+
+		void push(Task&& task, int, std::size_t worker)
+		{
+			if (worker >= this->m_count) {
+				worker = this->m_next.fetch_add(1, std::memory_order_relaxed) % this->m_count;
+			}
+
+			auto& slot = this->m_slots[worker];
+			const std::lock_guard<std::mutex> locker(slot.mutex);
+			slot.tasks.push_back(std::move(task));
+			this->m_size.fetch_add(1, std::memory_order_seq_cst);
+		}
+
+		bool pop(Task& task, std::size_t worker)
+		{
+			if (worker < this->m_count) {
+				auto& own = this->m_slots[worker];
+				const std::lock_guard<std::mutex> locker(own.mutex);
+				if (!own.tasks.empty()) {
+					task = std::move(own.tasks.back());
+					own.tasks.pop_back();
+					this->m_size.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+
+			const auto first = worker < this->m_count ? worker + 1 : 0;
+			for (std::size_t i = 0; i < this->m_count; ++i) {
+				auto& victim = this->m_slots[(first + i) % this->m_count];
+				const std::lock_guard<std::mutex> locker(victim.mutex);
+				if (!victim.tasks.empty()) {
+					task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					this->m_size.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		std::size_t size() const noexcept { return this->m_size.load(std::memory_order_seq_cst); }
+
+	private:
+		struct Slot {
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		std::unique_ptr<Slot[]> m_slots;
+		std::size_t m_count;
+		std::atomic<std::size_t> m_next{0};
+		std::atomic<std::size_t> m_size{0};
+	};
+};
+
+class BlockingWait {
+public:
+	template<typename Ready>
+	void wait(Ready ready)
+	{
+		if (ready()) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> locker(this->m_mutex);
+		this->m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+		this->m_cv.wait(locker, ready);
+		this->m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Callers publish the work with a seq_cst store first, so either they see the sleeper or it sees the work
+	void notifyOne()
+	{
+		if (this->m_sleepers.load(std::memory_order_seq_cst)) {
+			{
+				const std::lock_guard<std::mutex> locker(this->m_mutex);
+			}
+
+			this->m_cv.notify_one();
+		}
+	}
+
+	void notifyAll()
+	{
+		{
+			const std::lock_guard<std::mutex> locker(this->m_mutex);
+		}
+
+		this->m_cv.notify_all();
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::atomic<int> m_sleepers{0};
+};
+
+// Never sleeps: lowest wake-up latency, one busy core per idle worker
+class SpinWait {
+public:
+	template<typename Ready>
+	void wait(Ready ready)
+	{
+		while (!ready()) {
+			std::this_thread::yield();
+		}
+	}
+
+	void notifyOne() noexcept {}
+	void notifyAll() noexcept {}
+};
+
+template<unsigned int Spins = 1024>
+class HybridWait {
+public:
+	template<typename Ready>
+	void wait(Ready ready)
+	{
+		for (unsigned int i = 0; i < Spins; ++i) {
+			if (ready()) {
+				return;
+			}
+
+			std::this_thread::yield();
+		}
+
+		this->m_block.wait(ready);
+	}
+
+	void notifyOne() { this->m_block.notifyOne(); }
+	void notifyAll() { this->m_block.notifyAll(); }
+
+private:
+	BlockingWait m_block;
+};
+
+// Same ownership rules as ThreadPool: the task is deleted after run() when autoDelete() is set
+struct RunnableTask {
+	using type = Runnable*;
+
+	static void run(type& task)
+	{
+		const auto auto_delete = task->autoDelete();
+		task->run();
+		if (auto_delete) {
+			delete task;
+		}
+	}
+};
+
+struct FunctionPointerTask {
+	struct type {
+		void (*function)(void*);
+		void* argument;
+	};
+
+	static void run(type& task) { task.function(task.argument); }
+};
+
+// Type-erased callable stored inline when it fits in `Size` bytes, on the heap otherwise
+template<std::size_t Size = 3 * sizeof(void*)>
+struct InlineCallableTask {
+	class type {
+	public:
+		type() noexcept = default;
+
+		template<typename F, typename Fn = typename std::decay<F>::type, typename = typename std::enable_if<!std::is_same<Fn, type>::value>::type>
+		type(F&& f)
+		{
+			this->template construct<Fn>(std::forward<F>(f), std::integral_constant<bool, type::fits<Fn>()>());
+		}
+
+		type(type&& other) noexcept : m_ops(other.m_ops)
+		{
+			if (this->m_ops) {
+				this->m_ops->move(&this->m_storage, &other.m_storage);
+				other.m_ops = nullptr;
+			}
+		}
+
+		type& operator=(type&& other) noexcept
+		{
+			if (this != &other) {
+				this->reset();
+				this->m_ops = other.m_ops;
+				if (this->m_ops) {
+					this->m_ops->move(&this->m_storage, &other.m_storage);
+					other.m_ops = nullptr;
+				}
+			}
+
+			return *this;
+		}
+
+		type(const type&) = delete;
+		type& operator=(const type&) = delete;
+
+		~type() { this->reset(); }
+
+		explicit operator bool() const noexcept { return this->m_ops != nullptr; }
+		void operator()() { this->m_ops->call(&this->m_storage); }
+
+	private:
+		struct Ops {
+			void (*call)(void*);
+			void (*move)(void*, void*);
+			void (*destroy)(void*);
+		};
+
+		using Storage = typename std::aligned_storage<Size < sizeof(void*) ? sizeof(void*) : Size, alignof(std::max_align_t)>::type;
+
+		template<typename Fn>
+		static constexpr bool fits()
+		{
+			return sizeof(Fn) <= sizeof(Storage) && alignof(Fn) <= alignof(Storage) && std::is_nothrow_move_constructible<Fn>::value;
+		}
+
+		template<typename Fn>
+		static const Ops* ops(std::true_type)
+		{
+			static const Ops o = {
+				[](void* p) { (*static_cast<Fn*>(p))(); },
+				[](void* dst, void* src) {
+					new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+					static_cast<Fn*>(src)->~Fn();
+				},
+				[](void* p) { static_cast<Fn*>(p)->~Fn(); }
+			};
+
+			return &o;
+		}
+
+		template<typename Fn>
+		static const Ops* ops(std::false_type)
+		{
+			static const Ops o = {
+				[](void* p) { (**static_cast<Fn**>(p))(); },
+				[](void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); },
+				[](void* p) { delete *static_cast<Fn**>(p); }
+			};
+
+			return &o;
+		}
+
+		template<typename Fn, typename F>
+		void construct(F&& f, std::true_type)
+		{
+			new (&this->m_storage) Fn(std::forward<F>(f));
+			this->m_ops = type::template ops<Fn>(std::true_type());
+		}
+
+		template<typename Fn, typename F>
+		void construct(F&& f, std::false_type)
+		{
+			*reinterpret_cast<Fn**>(&this->m_storage) = new Fn(std::forward<F>(f));
+			this->m_ops = type::template ops<Fn>(std::false_type());
+		}
+
+		void reset() noexcept
+		{
+			if (this->m_ops) {
+				this->m_ops->destroy(&this->m_storage);
+				this->m_ops = nullptr;
+			}
+		}
+
+		const Ops* m_ops = nullptr;
+		Storage m_storage;
+	};
+
+	static void run(type& task) { task(); }
+};
+
+template<typename QueuePolicy = FifoQueue, typename WaitPolicy = BlockingWait, typename TaskPolicy = RunnableTask>
+class BasicThreadPool {
+public:
+	using task_type = typename TaskPolicy::type;
+
+	static const std::size_t npos = static_cast<std::size_t>(-1);
+
+	explicit BasicThreadPool(std::size_t threads = 0)
+		: m_queue(threads ? threads : std::max(std::thread::hardware_concurrency(), 1u))
+	{
+		if (!threads) {
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+
+		this->m_threads.reserve(threads);
+		for (std::size_t i = 0; i < threads; ++i) {
+			this->m_threads.emplace_back(&BasicThreadPool::worker, this, i);
+		}
+	}
+
+	// Runs everything still queued, then joins the workers
+	~BasicThreadPool()
+	{
+		this->m_stop.store(true, std::memory_order_seq_cst);
+		this->m_wait.notifyAll();
+		for (auto& t : this->m_threads) {
+			t.join();
+		}
+	}
+
+	BasicThreadPool(const BasicThreadPool&) = delete;
+	BasicThreadPool& operator=(const BasicThreadPool&) = delete;
+
+	void start(task_type task, int priority = 0)
+	{
+		this->m_pending.fetch_add(1, std::memory_order_relaxed);
+		this->m_queue.push(std::move(task), priority, this->currentWorker());
+		this->m_wait.notifyOne();
+	}
+
+	void waitForDone()
+	{
+		std::unique_lock<std::mutex> locker(this->m_doneMutex);
+		this->m_done.wait(locker, [this] { return this->m_pending.load(std::memory_order_acquire) == 0; });
+	}
+
+	std::size_t threadCount() const noexcept { return this->m_threads.size(); }
+	std::size_t queueSize() const noexcept { return this->m_queue.size(); }
+
+private:
+	struct Current {
+		const void* pool;
+		std::size_t index;
+	};
+
+	static Current& current() noexcept
+	{
+		static thread_local Current c = { nullptr, npos };
+		return c;
+	}
+
+	std::size_t currentWorker() const noexcept
+	{
+		const auto& c = BasicThreadPool::current();
+		return c.pool == this ? c.index : npos;
+	}
+
+	void worker(std::size_t index)
+	{
+		BasicThreadPool::current() = { this, index };
+
+		task_type task;
+		while (true) {
+			this->m_wait.wait([this] {
+				return this->m_queue.size() != 0 || this->m_stop.load(std::memory_order_seq_cst);
+			});
+
+			if (!this->m_queue.pop(task, index)) {
+				if (this->m_stop.load(std::memory_order_acquire) && !this->m_queue.size()) {
+					break;
+				}
+
+				continue;
+			}
+
+			TaskPolicy::run(task);
+			task = task_type();
+
+			if (this->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				const std::lock_guard<std::mutex> locker(this->m_doneMutex);
+				this->m_done.notify_all();
+			}
+		}
+
+		BasicThreadPool::current() = { nullptr, npos };
+	}
+
+	typename QueuePolicy::template type<task_type> m_queue;
+	WaitPolicy m_wait;
+	std::atomic<bool> m_stop{false};
+	std::atomic<std::size_t> m_pending{0};
+	std::mutex m_doneMutex;
+	std::condition_variable m_done;
+	std::vector<std::thread> m_threads;
+};
+
+template<typename QueuePolicy, typename WaitPolicy, typename TaskPolicy>
+const std::size_t BasicThreadPool<QueuePolicy, WaitPolicy, TaskPolicy>::npos;
+
+#endif // BASICTHREADPOOL_H
@@ -0,0 +1,35 @@
+#ifndef CACHELINE_H
+#define CACHELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// std::hardware_destructive_interference_size is C++17
+static constexpr std::size_t cache_line_size = 64;
+
+/*
+ * Base for classes with alignas(cache_line_size) members: before C++17
+ * operator new only guarantees alignof(std::max_align_t), so heap
+ * instances would not start on a line boundary.
+ */
+struct CacheAligned {
+	static void* operator new(std::size_t size)
+	{
+		auto* raw = ::operator new(size + cache_line_size);
+		auto addr = (reinterpret_cast<std::uintptr_t>(raw) + cache_line_size) & ~static_cast<std::uintptr_t>(cache_line_size - 1);
+
+		// At least sizeof(void*) bytes are skipped, enough to remember where the block starts
+		reinterpret_cast<void**>(addr)[-1] = raw;
+		return reinterpret_cast<void*>(addr);
+	}
+
+	static void operator delete(void* p) noexcept
+	{
+		if (p) {
+			::operator delete(static_cast<void**>(p)[-1]);
+		}
+	}
+};
+
+#endif // CACHELINE_H
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <thread>
+#include "doorbell.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+Doorbell::Doorbell()
+{
+	this->m_fd[0] = this->m_fd[1] = -1;
+
+#ifdef __linux__
+	this->m_fd[0] = this->m_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
+	if (this->m_fd[0] == -1 && pipe(this->m_fd) == 0) {
+		for (auto fd : this->m_fd) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+}
+
+Doorbell::~Doorbell()
+{
+	if (this->m_fd[0] != -1) {
+		close(this->m_fd[0]);
+	}
+
+	if (this->m_fd[1] != this->m_fd[0]) {
+		close(this->m_fd[1]);
+	}
+}
+
+void Doorbell::ring() noexcept
+{
+	// A full pipe or a saturated eventfd counter already means "rung"
+	const std::uint64_t one = 1;
+	const auto saved        = errno;
+	const auto res          = write(this->m_fd[1], &one, this->m_fd[0] == this->m_fd[1] ? sizeof(one) : 1);
+	static_cast<void>(res);
+	errno = saved;
+}
+
+bool Doorbell::wait(unsigned long int msecs) noexcept
+{
+	pollfd pfd;
+	pfd.fd      = this->m_fd[0];
+	pfd.events  = POLLIN;
+	pfd.revents = 0;
+
+	int res;
+	do {
+		res = poll(&pfd, 1, static_cast<int>(std::min<unsigned long int>(msecs, INT_MAX)));
+	} while (res == -1 && errno == EINTR);
+
+	this->m_armed.store(false, std::memory_order_relaxed);
+	if (res <= 0) {
+		return false;
+	}
+
+	this->consume();
+	return true;
+}
+
+void Doorbell::consume() noexcept
+{
+	std::uint64_t buf[8];
+	while (read(this->m_fd[0], buf, sizeof(buf)) > 0) {
+		// Drain everything rung so far
+	}
+}
+
+#else
+
+Doorbell::Doorbell()
+{
+}
+
+Doorbell::~Doorbell()
+{
+}
+
+void Doorbell::ring() noexcept
+{
+	this->m_rung.store(true, std::memory_order_release);
+}
+
+bool Doorbell::wait(unsigned long int msecs) noexcept
+{
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msecs);
+	while (!this->m_rung.exchange(false, std::memory_order_acquire)) {
+		if (std::chrono::steady_clock::now() >= deadline) {
+			this->m_armed.store(false, std::memory_order_relaxed);
+			return false;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	this->m_armed.store(false, std::memory_order_relaxed);
+	return true;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef DOORBELL_H
+#define DOORBELL_H
+
+#include <atomic>
+
+/*
+ * Wakes a single waiter from any context, signal handlers included:
+ * ring() does nothing but a write(2) on an eventfd (a pipe where eventfd
+ * is not available). notify() only makes the system call when the
+ * waiter has armed the doorbell and has not been woken since.
+ */
+class Doorbell {
+public:
+	Doorbell();
+	~Doorbell();
+
+	Doorbell(const Doorbell&) = delete;
+	Doorbell& operator=(const Doorbell&) = delete;
+
+	void ring() noexcept;
+
+	void notify() noexcept
+	{
+		if (this->m_armed.exchange(false, std::memory_order_seq_cst)) {
+			this->ring();
+		}
+	}
+
+	void arm() noexcept
+	{
+		this->m_armed.store(true, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	void disarm() noexcept { this->m_armed.store(false, std::memory_order_relaxed); }
+
+	// Returns true when woken up, false on timeout
+	bool wait(unsigned long int msecs) noexcept;
+
+#if defined(__unix__) || defined(__APPLE__)
+	// For waiting on the doorbell together with other descriptors; consume() once it is readable
+	int fd() const noexcept { return this->m_fd[0]; }
+	void consume() noexcept;
+#endif
+
+private:
+	std::atomic<bool> m_armed{false};
+#if defined(__unix__) || defined(__APPLE__)
+	int m_fd[2];
+#else
+	std::atomic<bool> m_rung{false};
+#endif
+};
+
+#endif // DOORBELL_H
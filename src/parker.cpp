@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include "parker.h"
+
+#ifdef __linux__
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+bool Parker::park(unsigned long int msecs) noexcept
+{
+	int expected = Empty;
+	if (!this->m_state.compare_exchange_strong(expected, Parked, std::memory_order_acq_rel)) {
+		this->m_state.store(Empty, std::memory_order_relaxed);
+		return true;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::min<unsigned long int>(msecs, INT_MAX));
+	while (true) {
+		const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (left <= 0) {
+			expected = Parked;
+			if (this->m_state.compare_exchange_strong(expected, Empty, std::memory_order_acq_rel)) {
+				return false;
+			}
+
+			break;
+		}
+
+		timespec ts;
+		ts.tv_sec  = static_cast<time_t>(left / 1000000000);
+		ts.tv_nsec = static_cast<long>(left % 1000000000);
+
+		// Returns at once if notify() got in first; spurious and late wakeups just go round the loop
+		syscall(SYS_futex, reinterpret_cast<int*>(&this->m_state), FUTEX_WAIT_PRIVATE, static_cast<int>(Parked), &ts, nullptr, 0);
+		if (this->m_state.load(std::memory_order_acquire) == Notified) {
+			break;
+		}
+	}
+
+	this->m_state.store(Empty, std::memory_order_relaxed);
+	return true;
+}
+
+void Parker::wake() noexcept
+{
+	syscall(SYS_futex, reinterpret_cast<int*>(&this->m_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+#else
+
+bool Parker::park(unsigned long int msecs) noexcept
+{
+	int expected = Empty;
+	if (this->m_state.compare_exchange_strong(expected, Parked, std::memory_order_acq_rel)) {
+		std::unique_lock<std::mutex> lock(this->m_mutex);
+		const auto notified = this->m_cv.wait_for(lock, std::chrono::milliseconds(std::min<unsigned long int>(msecs, INT_MAX)), [this] {
+			return this->m_state.load(std::memory_order_acquire) != Parked;
+		});
+
+		expected = Parked;
+		if (!notified && this->m_state.compare_exchange_strong(expected, Empty, std::memory_order_acq_rel)) {
+			return false;
+		}
+	}
+
+	this->m_state.store(Empty, std::memory_order_relaxed);
+	return true;
+}
+
+void Parker::wake() noexcept
+{
+	const std::lock_guard<std::mutex> lock(this->m_mutex);
+	this->m_cv.notify_one();
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef PARKER_H
+#define PARKER_H
+
+#include <atomic>
+#include "cacheline.h"
+
+#ifndef __linux__
+#include <condition_variable>
+#include <mutex>
+#endif
+
+/*
+ * Where an idle worker sleeps. notify() is a single atomic exchange and
+ * tells whether the owner is actually asleep; only then does wake() have
+ * to be called, which is one FUTEX_WAKE on Linux and may happen after
+ * the caller has released its own locks. A notification that arrives
+ * before the owner parks is not lost: park() returns right away.
+ */
+class Parker : public CacheAligned {
+public:
+	Parker() = default;
+	Parker(const Parker&) = delete;
+	Parker& operator=(const Parker&) = delete;
+
+	// Returns true when notified, false on timeout
+	bool park(unsigned long int msecs) noexcept;
+
+	bool notify() noexcept { return this->m_state.exchange(Notified, std::memory_order_acq_rel) == Parked; }
+	void wake() noexcept;
+
+	void unpark() noexcept
+	{
+		if (this->notify()) {
+			this->wake();
+		}
+	}
+
+	// Drops a notification nobody is going to wait for
+	void reset() noexcept { this->m_state.store(Empty, std::memory_order_relaxed); }
+
+private:
+	enum : int {
+		Parked   = -1,
+		Empty    = 0,
+		Notified = 1
+	};
+
+	alignas(cache_line_size) std::atomic<int> m_state{Empty};
+#ifndef __linux__
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+#endif
+};
+
+#endif // PARKER_H
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <memory>
+#include "pipeline.h"
+#include "threadpool.h"
+
+Pipeline::Pipeline(ThreadPool* pool, int priority)
+	: m_pool(pool), m_priority(priority)
+{
+}
+
+void Pipeline::addStage(PipelineStage* stage)
+{
+	if (!stage) {
+		return;
+	}
+
+	const auto mode   = stage->mode();
+	const auto serial = this->m_stages.empty() || mode != PipelineStage::Mode::Parallel;
+	this->m_stages.push_back(Stage{ stage, serial, mode == PipelineStage::Mode::SerialInOrder, false, 0, {} });
+}
+
+std::size_t Pipeline::run(std::size_t maxTokens)
+{
+	if (this->m_stages.empty()) {
+		return 0;
+	}
+
+	std::unique_lock<std::mutex> locker(this->m_mutex);
+	for (auto& s : this->m_stages) {
+		s.busy = false;
+		s.next = 0;
+	}
+
+	this->m_maxTokens = std::max<std::size_t>(maxTokens, 1);
+	this->m_inFlight  = 0;
+	this->m_produced  = 0;
+	this->m_inputDone = false;
+	this->m_error     = nullptr;
+	this->m_cancelled.store(false, std::memory_order_relaxed);
+	this->m_inputScheduled = true;
+
+	locker.unlock();
+	this->startInput();
+	locker.lock();
+
+	this->m_done.wait(locker, [this]() {
+		return this->m_inputDone && !this->m_inFlight && !this->m_inputScheduled;
+	});
+
+	if (this->m_error) {
+		auto e = this->m_error;
+		this->m_error = nullptr;
+		std::rethrow_exception(e);
+	}
+
+	return this->m_produced;
+}
+
+void Pipeline::process(Token* token)
+{
+	if (!token && !(token = this->input())) {
+		return;
+	}
+
+	// The token stays on this worker until a serial stage is busy with an earlier one
+	for (; token->stage < this->m_stages.size(); ++token->stage) {
+		auto& s = this->m_stages[token->stage];
+		if (s.serial && !this->enter(token)) {
+			return;
+		}
+
+		if (!this->m_cancelled.load(std::memory_order_acquire)) {
+			try {
+				token->item = s.stage->process(token->item);
+			}
+			catch (...) {
+				this->fail(std::current_exception());
+			}
+		}
+
+		if (s.serial) {
+			this->resume(this->leave(token));
+		}
+	}
+
+	this->finish(token);
+}
+
+Pipeline::Token* Pipeline::input()
+{
+	// Only one input task exists at a time, so the first stage needs no lock of its own
+	void* item = nullptr;
+	if (!this->m_cancelled.load(std::memory_order_acquire)) {
+		try {
+			item = this->m_stages.front().stage->process(nullptr);
+		}
+		catch (...) {
+			this->fail(std::current_exception());
+		}
+	}
+
+	std::unique_lock<std::mutex> locker(this->m_mutex);
+	if (!item) {
+		this->m_inputDone      = true;
+		this->m_inputScheduled = false;
+		if (!this->m_inFlight) {
+			this->m_done.notify_all();
+		}
+
+		return nullptr;
+	}
+
+	auto* token = new Token{ item, this->m_produced++, 1, false };
+	++this->m_inFlight;
+
+	// Out of tokens, the next input task is started by the first token to finish
+	this->m_inputScheduled = this->m_inFlight < this->m_maxTokens && !this->m_cancelled.load(std::memory_order_relaxed);
+	if (this->m_inputScheduled) {
+		locker.unlock();
+		this->startInput();
+	}
+
+	return token;
+}
+
+bool Pipeline::enter(Token* token)
+{
+	if (token->admitted) {
+		token->admitted = false;
+		return true;
+	}
+
+	auto& s = this->m_stages[token->stage];
+	const std::unique_lock<std::mutex> locker(this->m_mutex);
+	if (s.busy || (s.inOrder && token->seq != s.next)) {
+		s.waiting.emplace(token->seq, token);
+		return false;
+	}
+
+	s.busy = true;
+	return true;
+}
+
+Pipeline::Token* Pipeline::leave(Token* token)
+{
+	auto& s = this->m_stages[token->stage];
+	const std::unique_lock<std::mutex> locker(this->m_mutex);
+	s.busy = false;
+	++s.next;
+
+	if (s.waiting.empty()) {
+		return nullptr;
+	}
+
+	auto it = s.waiting.begin();
+	if (s.inOrder && it->first != s.next) {
+		return nullptr;
+	}
+
+	// The waiting token owns the stage from here on, and resumes on another worker
+	auto* waiting = it->second;
+	s.waiting.erase(it);
+	s.busy            = true;
+	waiting->admitted = true;
+	return waiting;
+}
+
+void Pipeline::finish(Token* token)
+{
+	delete token;
+
+	std::unique_lock<std::mutex> locker(this->m_mutex);
+	--this->m_inFlight;
+	if (!this->m_inputDone && !this->m_inputScheduled) {
+		if (this->m_cancelled.load(std::memory_order_relaxed)) {
+			this->m_inputDone = true;
+		}
+		else {
+			this->m_inputScheduled = true;
+			locker.unlock();
+			this->startInput();
+			return;
+		}
+	}
+
+	if (this->m_inputDone && !this->m_inFlight && !this->m_inputScheduled) {
+		this->m_done.notify_all();
+	}
+}
+
+void Pipeline::fail(std::exception_ptr e)
+{
+	const std::unique_lock<std::mutex> locker(this->m_mutex);
+	if (!this->m_error) {
+		this->m_error = e;
+	}
+
+	this->m_cancelled.store(true, std::memory_order_release);
+}
+
+bool Pipeline::startTask(Token* token)
+{
+	try {
+		std::unique_ptr<Task> task(new Task(this, token));
+		this->m_pool->start(task.get(), this->m_priority);
+		task.release();
+	}
+	catch (...) {
+		this->fail(std::current_exception());
+		return false;
+	}
+
+	return true;
+}
+
+void Pipeline::startInput()
+{
+	if (this->startTask(nullptr)) {
+		return;
+	}
+
+	// fail() has stopped the input, so this was its last task
+	const std::unique_lock<std::mutex> locker(this->m_mutex);
+	this->m_inputScheduled = false;
+	this->m_inputDone      = true;
+	if (!this->m_inFlight) {
+		this->m_done.notify_all();
+	}
+}
+
+void Pipeline::resume(Token* token)
+{
+	// The pipeline is cancelled once the pool refuses the task: the token passes the remaining stages here, unprocessed, and releases them on its way
+	if (token && !this->startTask(token)) {
+		this->process(token);
+	}
+}
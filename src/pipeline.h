@@ -0,0 +1,131 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "runnable.h"
+
+class ThreadPool;
+
+/*
+ * One step of a Pipeline. process() gets the item produced by the
+ * previous stage and returns the item for the next one; the first stage
+ * gets nullptr and returns nullptr once its input is exhausted, and the
+ * value returned by the last stage is ignored.
+ *
+ * Parallel stages may process several items at once. Serial stages
+ * process one item at a time, and SerialInOrder ones see items in the
+ * order the first stage produced them. The first stage is always serial.
+ */
+class PipelineStage {
+public:
+	enum class Mode {
+		Parallel,
+		SerialInOrder,
+		SerialOutOfOrder
+	};
+
+	explicit PipelineStage(Mode mode) : m_mode(mode) {}
+	virtual ~PipelineStage() = default;
+
+	Mode mode() const noexcept { return this->m_mode; }
+
+	virtual void* process(void* item) = 0;
+
+private:
+	Mode m_mode;
+};
+
+/*
+ * Runs items through a chain of stages on ThreadPool workers, in the
+ * spirit of TBB's parallel_pipeline. An item stays on the worker that
+ * took it from the first stage for as long as it can, and only moves to
+ * another worker after waiting for a busy serial stage. At most
+ * `maxTokens` items are in flight, which also bounds the number of items
+ * buffered in front of any serial stage.
+ *
+ * run() must not be called from a worker of the same pool: it blocks
+ * until the pipeline is done. The first exception thrown by a stage stops
+ * the input, lets the items already in flight pass the remaining stages
+ * without being processed, and is rethrown from run(). A task the pool
+ * refuses to start fails the pipeline the same way.
+ */
+class Pipeline {
+public:
+	explicit Pipeline(ThreadPool* pool, int priority = 0);
+	~Pipeline() = default;
+
+	Pipeline(const Pipeline&) = delete;
+	Pipeline& operator=(const Pipeline&) = delete;
+
+	// Stages are not owned and must outlive run()
+	void addStage(PipelineStage* stage);
+	std::size_t stageCount() const noexcept { return this->m_stages.size(); }
+
+	// Returns the number of items taken from the first stage
+	std::size_t run(std::size_t maxTokens);
+
+private:
+	struct Token {
+		void* item;
+		std::size_t seq;
+		std::size_t stage;
+		bool admitted;
+	};
+
+	struct Stage {
+		PipelineStage* stage;
+		bool serial;
+		bool inOrder;
+		bool busy;
+		std::size_t next;
+		std::map<std::size_t, Token*> waiting;
+	};
+
+	class Task : public Runnable {
+	public:
+		Task(Pipeline* pipeline, Token* token) : m_pipeline(pipeline), m_token(token) {}
+
+		void run() override
+		{
+			this->m_pipeline->process(this->m_token);
+		}
+
+	private:
+		Pipeline* m_pipeline;
+		Token* m_token;
+	};
+
+	void process(Token* token);
+	Token* input();
+	bool enter(Token* token);
+	Token* leave(Token* token);
+	void finish(Token* token);
+	void fail(std::exception_ptr e);
+
+	// Called without the lock
+	bool startTask(Token* token);
+	void startInput();
+	void resume(Token* token);
+
+	ThreadPool* m_pool;
+	int m_priority;
+	std::vector<Stage> m_stages;
+
+	std::mutex m_mutex;
+	std::condition_variable m_done;
+	std::size_t m_maxTokens = 0;
+	std::size_t m_inFlight  = 0;
+	std::size_t m_produced  = 0;
+	bool m_inputScheduled   = false;
+	bool m_inputDone        = false;
+	std::atomic<bool> m_cancelled{false};
+	std::exception_ptr m_error;
+};
+
+#endif // PIPELINE_H
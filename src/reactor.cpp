@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <climits>
+#include "reactor.h"
+#include "doorbell.h"
+#include "threadpool.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+namespace {
+
+std::uint32_t toEpoll(unsigned int events)
+{
+	std::uint32_t res = EPOLLONESHOT;
+	if (events & ThreadPool::IoRead) {
+		res |= EPOLLIN | EPOLLRDHUP;
+	}
+
+	if (events & ThreadPool::IoWrite) {
+		res |= EPOLLOUT;
+	}
+
+	return res;
+}
+
+unsigned int fromEpoll(std::uint32_t events)
+{
+	unsigned int res = 0;
+	if (events & EPOLLIN) {
+		res |= ThreadPool::IoRead;
+	}
+
+	if (events & EPOLLOUT) {
+		res |= ThreadPool::IoWrite;
+	}
+
+	if (events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+		res |= ThreadPool::IoHangup;
+	}
+
+	return res;
+}
+
+}
+
+Reactor::Reactor(Doorbell* doorbell)
+	: m_doorbell(doorbell)
+{
+}
+
+Reactor::~Reactor()
+{
+	if (this->m_epoll != -1) {
+		close(this->m_epoll);
+	}
+}
+
+bool Reactor::add(int fd, unsigned int events, Callback callback)
+{
+	// Created on first use: pools that never watch a descriptor do not need the extra fd
+	if (this->m_epoll == -1) {
+		this->m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (this->m_epoll == -1) {
+			return false;
+		}
+
+		epoll_event ev = {};
+		ev.events      = EPOLLIN;
+		ev.data.u64    = 0;
+		if (epoll_ctl(this->m_epoll, EPOLL_CTL_ADD, this->m_doorbell->fd(), &ev) == -1) {
+			close(this->m_epoll);
+			this->m_epoll = -1;
+			return false;
+		}
+	}
+
+	if (fd < 0 || this->m_registrations.count(fd)) {
+		return false;
+	}
+
+	std::shared_ptr<Registration> reg(new Registration());
+	reg->fd       = fd;
+	reg->events   = events;
+	reg->token    = (static_cast<std::uint64_t>(++this->m_generation) << 32) | static_cast<std::uint32_t>(fd);
+	reg->callback = std::move(callback);
+
+	epoll_event ev = {};
+	ev.events      = toEpoll(events);
+	ev.data.u64    = reg->token;
+	if (epoll_ctl(this->m_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		return false;
+	}
+
+	this->m_registrations.emplace(fd, std::move(reg));
+	return true;
+}
+
+std::shared_ptr<Reactor::Registration> Reactor::remove(int fd)
+{
+	auto it = this->m_registrations.find(fd);
+	if (it == this->m_registrations.end()) {
+		return nullptr;
+	}
+
+	auto reg = std::move(it->second);
+	this->m_registrations.erase(it);
+	epoll_ctl(this->m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+	return reg;
+}
+
+void Reactor::clear()
+{
+	while (!this->m_registrations.empty()) {
+		this->remove(this->m_registrations.begin()->first);
+	}
+}
+
+bool Reactor::wait(unsigned long int msecs, std::uint64_t* token, unsigned int* events) noexcept
+{
+	epoll_event ev;
+	int res;
+	do {
+		res = epoll_wait(this->m_epoll, &ev, 1, static_cast<int>(std::min<unsigned long int>(msecs, INT_MAX)));
+	} while (res == -1 && errno == EINTR);
+
+	this->m_doorbell->disarm();
+	*token = 0;
+	if (res <= 0) {
+		return false;
+	}
+
+	if (!ev.data.u64) {
+		this->m_doorbell->consume();
+	}
+	else {
+		*token  = ev.data.u64;
+		*events = fromEpoll(ev.events);
+	}
+
+	return true;
+}
+
+void Reactor::rearm(const Registration& registration) noexcept
+{
+	epoll_event ev = {};
+	ev.events      = toEpoll(registration.events);
+	ev.data.u64    = registration.token;
+	epoll_ctl(this->m_epoll, EPOLL_CTL_MOD, registration.fd, &ev);
+}
+
+#else
+
+Reactor::Reactor(Doorbell* doorbell)
+	: m_doorbell(doorbell)
+{
+}
+
+Reactor::~Reactor()
+{
+}
+
+bool Reactor::add(int, unsigned int, Callback)
+{
+	return false;
+}
+
+std::shared_ptr<Reactor::Registration> Reactor::remove(int)
+{
+	return nullptr;
+}
+
+void Reactor::clear()
+{
+}
+
+bool Reactor::wait(unsigned long int msecs, std::uint64_t* token, unsigned int*) noexcept
+{
+	*token = 0;
+	return this->m_doorbell->wait(msecs);
+}
+
+void Reactor::rearm(const Registration&) noexcept
+{
+}
+
+#endif
+
+std::shared_ptr<Reactor::Registration> Reactor::find(std::uint64_t token) const
+{
+	auto it = this->m_registrations.find(static_cast<int>(token & 0xFFFFFFFFu));
+	return it != this->m_registrations.end() && it->second->token == token ? it->second : nullptr;
+}
@@ -0,0 +1,58 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+
+class Doorbell;
+class ThreadPoolThread;
+
+/*
+ * epoll set shared by the workers of one pool (leader/followers): the
+ * idle worker that currently watches the pool's doorbell waits on this
+ * set instead and runs the callback of a ready descriptor itself.
+ * Descriptors are registered one-shot and re-armed once their callback
+ * returns, so a callback never runs twice at the same time.
+ *
+ * Everything except wait() and rearm() is called with the pool locked.
+ * Only available on Linux; add() fails elsewhere.
+ */
+class Reactor {
+public:
+	using Callback = std::function<void(int, unsigned int)>;
+
+	struct Registration {
+		int fd;
+		unsigned int events;
+		std::uint64_t token;
+		Callback callback;
+		ThreadPoolThread* runner = nullptr;
+	};
+
+	explicit Reactor(Doorbell* doorbell);
+	~Reactor();
+
+	Reactor(const Reactor&) = delete;
+	Reactor& operator=(const Reactor&) = delete;
+
+	bool add(int fd, unsigned int events, Callback callback);
+	std::shared_ptr<Registration> remove(int fd);
+	std::shared_ptr<Registration> find(std::uint64_t token) const;
+	void clear();
+
+	bool empty() const noexcept { return this->m_registrations.empty(); }
+
+	// Waits for the doorbell or one ready descriptor (token != 0); false on timeout
+	bool wait(unsigned long int msecs, std::uint64_t* token, unsigned int* events) noexcept;
+	void rearm(const Registration& registration) noexcept;
+
+private:
+	Doorbell* m_doorbell;
+	int m_epoll = -1;
+	std::uint32_t m_generation = 0;
+	std::map<int, std::shared_ptr<Registration> > m_registrations;
+};
+
+#endif // REACTOR_H
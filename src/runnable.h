@@ -1,20 +1,49 @@
 #ifndef RUNNABLE_H
 #define RUNNABLE_H
 
+#include <atomic>
+#include "tasknode.h"
+
 class Runnable {
 public:
+	Runnable() = default;
+	Runnable(const Runnable& other) noexcept : m_ref(other.autoDelete() ? 0 : -1) {}
 	virtual ~Runnable(void) = default;
 
-	bool autoDelete() const noexcept { return this->m_ref != -1; }
-	void setAutoDelete(bool v) noexcept { this->m_ref = v ? 0 : -1; }
+	Runnable& operator=(const Runnable&) noexcept { return *this; }
+
+	bool autoDelete() const noexcept { return this->m_ref.load(std::memory_order_relaxed) != -1; }
+	void setAutoDelete(bool v) noexcept { this->m_ref.store(v ? 0 : -1, std::memory_order_relaxed); }
+
+	bool isQueued() const noexcept { return this->m_queued.load(std::memory_order_relaxed) != 0; }
 
 	virtual void run() = 0;
 private:
-	int m_ref = 0;
+	void ref() noexcept
+	{
+		if (this->autoDelete()) {
+			this->m_ref.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Returns true when the last pending submission of an auto-delete task is gone and the task must be deleted
+	bool deref() noexcept
+	{
+		return this->autoDelete() && this->m_ref.fetch_sub(1, std::memory_order_acq_rel) == 1;
+	}
+
+	std::atomic<int> m_ref{0};
+
+	// The embedded node makes queueing allocation-free; it is only borrowed by the first pending submission
+	std::atomic<int> m_queued{0};
+	std::atomic<bool> m_nodeInUse{false};
+	TaskNode m_node;
 
+	friend class SimulatedThreadPool;
 	friend class ThreadPool;
 	friend class ThreadPoolPrivate;
 	friend class ThreadPoolThread;
+	friend class TaskQueue;
 };
 
 #endif // RUNNABLE_H
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "shardedthreadpool.h"
+#include "threadpool.h"
+#include "threadpool_p.h"
+#include "tracer.h"
+
+namespace {
+
+// Thread ids and keys (often pointers) are poorly distributed in their low bits
+std::size_t mix(std::uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return static_cast<std::size_t>(h);
+}
+
+}
+
+ShardedThreadPool::ShardedThreadPool(std::size_t shards, std::size_t threadsPerShard)
+{
+	shards = std::max<std::size_t>(shards, 1);
+	if (!threadsPerShard) {
+		threadsPerShard = std::max<std::size_t>(std::thread::hardware_concurrency() / shards, 1);
+	}
+
+	this->m_shards.reserve(shards);
+	for (std::size_t i = 0; i < shards; ++i) {
+		this->m_shards.emplace_back(new ThreadPool());
+		this->m_shards.back()->setMaxThreadCount(threadsPerShard);
+	}
+
+	// Nearest neighbours first, so that not every idle shard goes after shard 0
+	for (std::size_t i = 0; i < shards; ++i) {
+		auto* d = this->m_shards[i]->d_func();
+		for (std::size_t j = 1; j < shards; ++j) {
+			d->siblings.push_back(this->m_shards[(i + j) % shards]->d_func());
+		}
+	}
+}
+
+ShardedThreadPool::~ShardedThreadPool()
+{
+	this->waitForDone();
+
+	for (auto& shard : this->m_shards) {
+		auto* d = shard->d_func();
+		const std::unique_lock<std::mutex> locker(d->mutex);
+		d->siblings.clear();
+	}
+}
+
+std::size_t ShardedThreadPool::shardIndex(std::size_t key) const noexcept
+{
+	return mix(key) % this->m_shards.size();
+}
+
+void ShardedThreadPool::start(Runnable* runnable, int priority)
+{
+	const auto h = std::hash<std::thread::id>()(std::this_thread::get_id());
+	this->startOnShard(this->shardIndex(h), runnable, priority);
+}
+
+void ShardedThreadPool::startKeyed(std::size_t key, Runnable* runnable, int priority)
+{
+	this->startOnShard(this->shardIndex(key), runnable, priority);
+}
+
+void ShardedThreadPool::startOnShard(std::size_t index, Runnable* runnable, int priority)
+{
+	if (!runnable) {
+		return;
+	}
+
+	trace(TraceEvent::Enqueue, runnable);
+
+	auto* d = this->m_shards[index]->d_func();
+	bool saturated;
+	Parker* wake;
+	{
+		const std::unique_lock<std::mutex> locker(d->mutex);
+		wake      = d->submit(runnable, priority, ThreadPoolPrivate::clock::time_point::max());
+		saturated = !d->queue.empty() && d->activeThreadCount() >= d->maxThreadCount;
+	}
+
+	if (wake) {
+		wake->wake();
+	}
+
+	if (saturated) {
+		for (auto* s : d->siblings) {
+			if (s->startIdleThread()) {
+				break;
+			}
+		}
+	}
+}
+
+void ShardedThreadPool::setExpiryTimeout(unsigned long int v)
+{
+	for (auto& shard : this->m_shards) {
+		shard->setExpiryTimeout(v);
+	}
+}
+
+std::size_t ShardedThreadPool::activeThreadCount() const
+{
+	std::size_t n = 0;
+	for (auto& shard : this->m_shards) {
+		n += shard->activeThreadCount();
+	}
+
+	return n;
+}
+
+std::size_t ShardedThreadPool::queueSize() const
+{
+	std::size_t n = 0;
+	for (auto& shard : this->m_shards) {
+		n += shard->queueSize();
+	}
+
+	return n;
+}
+
+bool ShardedThreadPool::waitForDone(unsigned long int timeout)
+{
+	using clock = std::chrono::steady_clock;
+
+	const auto forever  = timeout == std::numeric_limits<unsigned long int>::max();
+	const auto deadline = forever ? clock::time_point::max() : clock::now() + std::chrono::milliseconds(timeout);
+
+	// A task stolen from one shard may still be running (or submitting more work) after that shard reports done
+	while (true) {
+		for (auto& shard : this->m_shards) {
+			auto msecs = std::numeric_limits<unsigned long int>::max();
+			if (!forever) {
+				const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+				msecs = left > 0 ? static_cast<unsigned long int>(left) : 0;
+			}
+
+			if (!shard->waitForDone(msecs)) {
+				return false;
+			}
+		}
+
+		bool idle = true;
+		for (auto& shard : this->m_shards) {
+			auto* d = shard->d_func();
+			const std::unique_lock<std::mutex> locker(d->mutex);
+			idle = idle && d->queue.empty() && !d->activeThreads;
+		}
+
+		if (idle) {
+			return true;
+		}
+	}
+}
+
+void ShardedThreadPool::clear()
+{
+	for (auto& shard : this->m_shards) {
+		shard->clear();
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef SHARDEDTHREADPOOL_H
+#define SHARDEDTHREADPOOL_H
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <vector>
+
+class Runnable;
+class ThreadPool;
+
+/*
+ * A set of independent ThreadPool shards (each with its own queue, lock
+ * and workers). Submitters pick a shard by hashing their thread id, or by
+ * hashing an explicit key so that related tasks keep hitting the same
+ * shard. Workers that run out of work in their own shard steal from the
+ * others, and a saturated shard wakes an idle sibling to help out.
+ */
+class ShardedThreadPool {
+public:
+	explicit ShardedThreadPool(std::size_t shards, std::size_t threadsPerShard = 0);
+	~ShardedThreadPool();
+
+	std::size_t shardCount() const noexcept { return this->m_shards.size(); }
+	std::size_t shardIndex(std::size_t key) const noexcept;
+	ThreadPool& shard(std::size_t index) { return *this->m_shards[index]; }
+
+	void start(Runnable* runnable, int priority = 0);
+	void startKeyed(std::size_t key, Runnable* runnable, int priority = 0);
+
+	void setExpiryTimeout(unsigned long int v);
+
+	std::size_t activeThreadCount() const;
+	std::size_t queueSize() const;
+
+	bool waitForDone(unsigned long int timeout = std::numeric_limits<unsigned long int>::max());
+	void clear();
+
+private:
+	void startOnShard(std::size_t index, Runnable* runnable, int priority);
+
+	std::vector<std::unique_ptr<ThreadPool> > m_shards;
+};
+
+#endif // SHARDEDTHREADPOOL_H
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include "simulatedthreadpool.h"
+#include "runnable.h"
+
+const std::size_t SimulatedThreadPool::npos;
+
+SimulatedThreadPool::SimulatedThreadPool(std::uint32_t seed, std::size_t threads)
+	: m_seed(seed), m_rng(seed), m_maxThreadCount(std::max<std::size_t>(threads, 1))
+{
+}
+
+SimulatedThreadPool::~SimulatedThreadPool()
+{
+	this->waitForDone();
+}
+
+void SimulatedThreadPool::start(Runnable* runnable, int priority)
+{
+	if (!runnable) {
+		return;
+	}
+
+	runnable->ref();
+	this->m_queue.push(runnable, priority);
+	this->dispatch();
+}
+
+bool SimulatedThreadPool::tryStart(Runnable* runnable)
+{
+	if (!runnable) {
+		return false;
+	}
+
+	const auto index = this->freeWorker();
+	if (index == npos) {
+		return false;
+	}
+
+	runnable->ref();
+	this->assign(index, runnable);
+	return true;
+}
+
+void SimulatedThreadPool::setMaxThreadCount(std::size_t n)
+{
+	this->m_maxThreadCount = std::max<std::size_t>(n, 1);
+	this->dispatch();
+}
+
+std::size_t SimulatedThreadPool::activeThreadCount() const noexcept
+{
+	return static_cast<std::size_t>(std::count_if(this->m_workers.begin(), this->m_workers.end(), [](const Worker& w) {
+		return w.task || w.running;
+	}));
+}
+
+std::size_t SimulatedThreadPool::threadCount() const noexcept
+{
+	return static_cast<std::size_t>(std::count_if(this->m_workers.begin(), this->m_workers.end(), [](const Worker& w) {
+		return w.alive;
+	}));
+}
+
+bool SimulatedThreadPool::waitForDone(unsigned long int timeout)
+{
+	const auto limit    = std::numeric_limits<unsigned long int>::max();
+	const auto deadline = timeout > limit - this->m_now ? limit : this->m_now + timeout;
+
+	while (this->activeThreadCount() || !this->m_queue.empty()) {
+		if (this->m_now >= deadline || !this->step()) {
+			return false;
+		}
+	}
+
+	// Like ThreadPool, a pool that is done lets all its workers go
+	for (std::size_t i = 0; i < this->m_workers.size(); ++i) {
+		if (this->m_workers[i].alive) {
+			this->expire(i);
+		}
+	}
+
+	return true;
+}
+
+void SimulatedThreadPool::clear()
+{
+	this->m_queue.clear([this](Runnable* r) {
+		this->release(r);
+	});
+}
+
+void SimulatedThreadPool::cancel(Runnable* runnable)
+{
+	if (runnable && this->m_queue.remove(runnable)) {
+		this->release(runnable);
+	}
+}
+
+bool SimulatedThreadPool::step()
+{
+	this->m_busy.clear();
+	for (std::size_t i = 0; i < this->m_workers.size(); ++i) {
+		if (this->m_workers[i].task) {
+			this->m_busy.push_back(i);
+		}
+	}
+
+	if (this->m_busy.empty()) {
+		return false;
+	}
+
+	// Taken modulo rather than through a distribution: mt19937 output is the same everywhere, distributions are not
+	const auto index = this->m_busy[this->m_rng() % this->m_busy.size()];
+	auto* r          = this->m_workers[index].task;
+
+	this->m_workers[index].task    = nullptr;
+	this->m_workers[index].running = true;
+
+	const auto previous = this->m_current;
+	this->m_current     = index;
+	try {
+		r->run();
+	}
+	catch (...) {
+		if (this->m_exceptionHandler) {
+			this->m_exceptionHandler(r, std::current_exception());
+		}
+	}
+
+	this->m_current = previous;
+	this->release(r);
+
+	// The task may have resized the pool, so the worker is looked up again
+	this->m_now += this->m_stepDuration;
+	this->m_workers[index].running = false;
+	this->m_workers[index].idle    = this->m_now;
+	if (index >= this->m_maxThreadCount) {
+		this->expire(index);
+	}
+
+	this->expireIdle();
+	this->dispatch();
+	return true;
+}
+
+void SimulatedThreadPool::advance(unsigned long int msecs)
+{
+	this->m_now += msecs;
+	this->expireIdle();
+}
+
+void SimulatedThreadPool::dispatch()
+{
+	// The queue is only looked at once a worker is known to be free: front() caches its pick until pop_front()
+	std::size_t index;
+	while (!this->m_queue.empty() && (index = this->freeWorker()) != npos) {
+		auto* r = this->m_queue.front();
+		this->m_queue.pop_front();
+		this->assign(index, r);
+	}
+}
+
+std::size_t SimulatedThreadPool::freeWorker()
+{
+	// Mirrors ThreadPool: an idle worker first, then a new one
+	this->m_workers.resize(std::max(this->m_workers.size(), this->m_maxThreadCount));
+	for (auto alive : { true, false }) {
+		for (std::size_t i = 0; i < this->m_maxThreadCount; ++i) {
+			const auto& w = this->m_workers[i];
+			if (w.alive == alive && !w.task && !w.running) {
+				return i;
+			}
+		}
+	}
+
+	return npos;
+}
+
+void SimulatedThreadPool::assign(std::size_t index, Runnable* runnable)
+{
+	auto& w = this->m_workers[index];
+	w.task  = runnable;
+	if (!w.alive) {
+		w.alive = true;
+		if (this->m_threadStartHook) {
+			this->m_threadStartHook(index);
+		}
+	}
+}
+
+void SimulatedThreadPool::expire(std::size_t index)
+{
+	this->m_workers[index].alive = false;
+	if (this->m_threadExitHook) {
+		this->m_threadExitHook(index);
+	}
+}
+
+void SimulatedThreadPool::expireIdle()
+{
+	for (std::size_t i = 0; i < this->m_workers.size(); ++i) {
+		const auto& w = this->m_workers[i];
+		if (w.alive && !w.task && !w.running && this->m_now - w.idle >= this->m_expiryTimeout) {
+			this->expire(i);
+		}
+	}
+}
+
+void SimulatedThreadPool::release(Runnable* runnable)
+{
+	if (runnable->deref()) {
+		delete runnable;
+	}
+}
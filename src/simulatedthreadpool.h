@@ -0,0 +1,110 @@
+#ifndef SIMULATEDTHREADPOOL_H
+#define SIMULATEDTHREADPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+#include "taskqueue.h"
+
+class Runnable;
+
+/*
+ * Test double for ThreadPool with the same submission, sizing, hook and
+ * waiting API, for reproducing schedule-dependent bugs. Everything runs
+ * on the calling thread: started tasks are handed to up to
+ * maxThreadCount() virtual workers, and step() runs the task of one busy
+ * worker, picked by a generator seeded in the constructor. The same seed
+ * always gives the same interleaving of task completions.
+ *
+ * Time is virtual: every step takes stepDuration() ms, advance() lets
+ * time pass without running anything, and both expiryTimeout() and the
+ * waitForDone() timeout are measured on that clock.
+ *
+ * Tasks must not block waiting for each other, as they would on a real
+ * pool: nothing else runs until they return.
+ */
+class SimulatedThreadPool {
+public:
+	using ExceptionHandler = std::function<void(Runnable*, std::exception_ptr)>;
+	using ThreadHook       = std::function<void(std::size_t)>;
+
+	static const std::size_t npos = static_cast<std::size_t>(-1);
+
+	explicit SimulatedThreadPool(std::uint32_t seed = 0, std::size_t threads = 4);
+	~SimulatedThreadPool();
+
+	SimulatedThreadPool(const SimulatedThreadPool&) = delete;
+	SimulatedThreadPool& operator=(const SimulatedThreadPool&) = delete;
+
+	void start(Runnable* runnable, int priority = 0);
+	bool tryStart(Runnable* runnable);
+
+	unsigned long int expiryTimeout() const noexcept { return this->m_expiryTimeout; }
+	void setExpiryTimeout(unsigned long int v) noexcept { this->m_expiryTimeout = v; }
+
+	void setExceptionHandler(ExceptionHandler handler) { this->m_exceptionHandler = std::move(handler); }
+	void setThreadStartHook(ThreadHook hook) { this->m_threadStartHook = std::move(hook); }
+	void setThreadExitHook(ThreadHook hook) { this->m_threadExitHook = std::move(hook); }
+
+	// Index of the virtual worker running the current task, npos outside of tasks
+	std::size_t currentWorkerIndex() const noexcept { return this->m_current; }
+
+	std::size_t maxThreadCount() const noexcept { return this->m_maxThreadCount; }
+	void setMaxThreadCount(std::size_t n);
+
+	std::size_t activeThreadCount() const noexcept;
+	std::size_t threadCount() const noexcept;
+	std::size_t queueSize() const noexcept { return this->m_queue.size(); }
+
+	bool waitForDone(unsigned long int timeout = std::numeric_limits<unsigned long int>::max());
+
+	void clear();
+	void cancel(Runnable* runnable);
+
+	std::uint32_t seed() const noexcept { return this->m_seed; }
+	unsigned long int now() const noexcept { return this->m_now; }
+
+	unsigned long int stepDuration() const noexcept { return this->m_stepDuration; }
+	void setStepDuration(unsigned long int msecs) noexcept { this->m_stepDuration = msecs; }
+
+	// Runs one task; false if no worker has anything to do
+	bool step();
+	// Lets virtual time pass; workers idle for longer than expiryTimeout() exit
+	void advance(unsigned long int msecs);
+
+private:
+	struct Worker {
+		Runnable* task         = nullptr;
+		bool alive             = false;
+		bool running           = false;
+		unsigned long int idle = 0;
+	};
+
+	void dispatch();
+	std::size_t freeWorker();
+	void assign(std::size_t index, Runnable* runnable);
+	void expire(std::size_t index);
+	void expireIdle();
+	void release(Runnable* runnable);
+
+	std::uint32_t m_seed;
+	std::mt19937 m_rng;
+	TaskQueue m_queue;
+	std::vector<Worker> m_workers;
+	std::vector<std::size_t> m_busy;
+	std::size_t m_maxThreadCount;
+	std::size_t m_current = npos;
+	unsigned long int m_now = 0;
+	unsigned long int m_stepDuration = 1;
+	unsigned long int m_expiryTimeout = 30000;
+	ExceptionHandler m_exceptionHandler;
+	ThreadHook m_threadStartHook;
+	ThreadHook m_threadExitHook;
+};
+
+#endif // SIMULATEDTHREADPOOL_H
@@ -0,0 +1,87 @@
+#ifndef SLOTARRAY_H
+#define SLOTARRAY_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "cacheline.h"
+
+/*
+ * Storage for objects that must not move, in contiguous arrays of
+ * cache-line padded slots: no two objects share a line, and neighbours
+ * sit next to each other instead of wherever the allocator put them.
+ * Each array is twice as large as the previous one. Slots are reused
+ * once their object is destroyed.
+ *
+ * Not thread-safe: callers serialize create() and destroy().
+ */
+template<typename T>
+class SlotArray {
+public:
+	SlotArray() = default;
+	SlotArray(const SlotArray&) = delete;
+	SlotArray& operator=(const SlotArray&) = delete;
+
+	// Every object must have been destroyed by now
+	~SlotArray()
+	{
+		for (auto* chunk : this->m_chunks) {
+			CacheAligned::operator delete(chunk);
+		}
+	}
+
+	template<typename... Args>
+	T* create(Args&&... args)
+	{
+		if (this->m_free.empty()) {
+			this->grow();
+		}
+
+		// The slot stays free if the constructor throws
+		auto* object = ::new (this->m_free.back()) T(std::forward<Args>(args)...);
+		this->m_free.pop_back();
+		return object;
+	}
+
+	void destroy(T* object) noexcept
+	{
+		object->~T();
+		// Never reallocates: grow() reserved room for every slot
+		this->m_free.push_back(reinterpret_cast<Slot*>(object));
+	}
+
+private:
+	struct alignas(cache_line_size) Slot {
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	void grow()
+	{
+		auto count = this->m_capacity;
+		if (!count) {
+			count = first_chunk;
+		}
+
+		this->m_free.reserve(this->m_capacity + count);
+		this->m_chunks.reserve(this->m_chunks.size() + 1);
+
+		auto* chunk = static_cast<Slot*>(CacheAligned::operator new(count * sizeof(Slot)));
+		this->m_chunks.push_back(chunk);
+		this->m_capacity += count;
+
+		// Lower addresses are handed out first
+		for (auto i = count; i > 0; --i) {
+			this->m_free.push_back(chunk + i - 1);
+		}
+	}
+
+	static constexpr std::size_t first_chunk = 4;
+
+	std::vector<Slot*> m_chunks;
+	std::vector<Slot*> m_free;
+	std::size_t m_capacity = 0;
+};
+
+#endif // SLOTARRAY_H
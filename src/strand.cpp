@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <thread>
+#include "strand.h"
+#include "threadpool.h"
+#include "threadpool_p.h"
+
+namespace {
+
+thread_local const Strand* t_current = nullptr;
+
+}
+
+Strand::Strand(ThreadPool* pool, std::size_t batchSize, int priority)
+	: m_pool(pool), m_batchSize(std::max<std::size_t>(batchSize, 1)), m_priority(priority),
+	  m_head(&m_stub), m_tail(&m_stub), m_dispatcher(this)
+{
+}
+
+Strand::~Strand()
+{
+	while (this->m_pending.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+}
+
+void Strand::post(Runnable* runnable)
+{
+	if (!runnable) {
+		return;
+	}
+
+	auto* node     = new Node();
+	node->runnable = runnable;
+	this->push(node);
+
+	// Only the transition from idle schedules a dispatch; the running dispatch picks up everything else
+	if (this->m_pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+		this->m_pool->start(&this->m_dispatcher, this->m_priority);
+	}
+}
+
+bool Strand::runningInThisThread() const noexcept
+{
+	return t_current == this;
+}
+
+// Vyukov's intrusive MPSC queue: producers never wait on each other, the single consumer is the running dispatch
+void Strand::push(Node* node) noexcept
+{
+	node->next.store(nullptr, std::memory_order_relaxed);
+	auto* prev = this->m_head.exchange(node, std::memory_order_acq_rel);
+	prev->next.store(node, std::memory_order_release);
+}
+
+Strand::Node* Strand::pop() noexcept
+{
+	auto* tail = this->m_tail;
+	auto* next = tail->next.load(std::memory_order_acquire);
+
+	if (tail == &this->m_stub) {
+		if (!next) {
+			return nullptr;
+		}
+
+		this->m_tail = next;
+		tail         = next;
+		next         = next->next.load(std::memory_order_acquire);
+	}
+
+	if (next) {
+		this->m_tail = next;
+		return tail;
+	}
+
+	if (tail != this->m_head.load(std::memory_order_acquire)) {
+		// A producer has swapped the head but not linked its node yet
+		return nullptr;
+	}
+
+	this->push(&this->m_stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next) {
+		this->m_tail = next;
+		return tail;
+	}
+
+	return nullptr;
+}
+
+void Strand::drain()
+{
+	const auto* previous = t_current;
+	t_current = this;
+
+	for (std::size_t done = 1; ; ++done) {
+		Node* node;
+		while (!(node = this->pop())) {
+			std::this_thread::yield();
+		}
+
+		auto* r = node->runnable;
+		delete node;
+
+		const auto auto_delete = r->autoDelete();
+		try {
+			r->run();
+		}
+		catch (...) {
+			// Reported here rather than rethrown: the pool would blame the dispatcher, which may be gone by then
+			this->m_pool->d_func()->taskFailed(r, std::current_exception());
+		}
+
+		if (auto_delete) {
+			delete r;
+		}
+
+		if (this->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			break;
+		}
+
+		if (done == this->m_batchSize) {
+			this->m_pool->start(&this->m_dispatcher, this->m_priority);
+			break;
+		}
+	}
+
+	t_current = previous;
+}
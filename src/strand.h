@@ -0,0 +1,69 @@
+#ifndef STRAND_H
+#define STRAND_H
+
+#include <atomic>
+#include <cstddef>
+#include "runnable.h"
+
+class ThreadPool;
+
+/*
+ * Serial executor on top of a ThreadPool: tasks posted to a strand run
+ * one at a time, in FIFO order, on pool workers. A single pool dispatch
+ * runs up to `batchSize` pending tasks before handing the worker back.
+ * A task that throws is reported to the pool's exception handler like
+ * any other failed task, and the strand moves on to the next one.
+ *
+ * The strand must outlive the tasks posted to it; the destructor waits
+ * for the pending ones to finish.
+ */
+class Strand {
+public:
+	explicit Strand(ThreadPool* pool, std::size_t batchSize = 64, int priority = 0);
+	~Strand();
+
+	Strand(const Strand&) = delete;
+	Strand& operator=(const Strand&) = delete;
+
+	void post(Runnable* runnable);
+
+	std::size_t pending() const noexcept { return this->m_pending.load(std::memory_order_relaxed); }
+	bool runningInThisThread() const noexcept;
+
+private:
+	struct Node {
+		std::atomic<Node*> next{nullptr};
+		Runnable* runnable = nullptr;
+	};
+
+	class Dispatcher : public Runnable {
+	public:
+		explicit Dispatcher(Strand* strand) : m_strand(strand)
+		{
+			this->setAutoDelete(false);
+		}
+
+		void run() override
+		{
+			this->m_strand->drain();
+		}
+
+	private:
+		Strand* m_strand;
+	};
+
+	void push(Node* node) noexcept;
+	Node* pop() noexcept;
+	void drain();
+
+	ThreadPool* m_pool;
+	std::size_t m_batchSize;
+	int m_priority;
+	std::atomic<std::size_t> m_pending{0};
+	std::atomic<Node*> m_head;
+	Node* m_tail;
+	Node m_stub;
+	Dispatcher m_dispatcher;
+};
+
+#endif // STRAND_H
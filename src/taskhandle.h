@@ -0,0 +1,414 @@
+#ifndef TASKHANDLE_H
+#define TASKHANDLE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "runnable.h"
+#include "threadpool.h"
+
+enum class Launch {
+	Async,  // schedule the continuation onto the pool
+	Inline  // run the continuation on the thread that completes the antecedent
+};
+
+/*
+ * Completion state shared between a task and its handles. Continuations
+ * are kept in a lock-free stack; completing the task swaps in a marker
+ * and runs them in registration order. A continuation registered after
+ * completion runs immediately on the registering thread.
+ */
+class TaskStateBase {
+public:
+	class Continuation {
+	public:
+		virtual ~Continuation() = default;
+		virtual void invoke() noexcept = 0;
+
+		Continuation* next = nullptr;
+	};
+
+	TaskStateBase() = default;
+	TaskStateBase(const TaskStateBase&) = delete;
+	TaskStateBase& operator=(const TaskStateBase&) = delete;
+
+	virtual ~TaskStateBase()
+	{
+		auto* c = this->m_continuations.load(std::memory_order_acquire);
+		if (c != TaskStateBase::completed()) {
+			while (c) {
+				auto* next = c->next;
+				delete c;
+				c = next;
+			}
+		}
+	}
+
+	bool isReady() const noexcept
+	{
+		return this->m_continuations.load(std::memory_order_acquire) == TaskStateBase::completed();
+	}
+
+	void addContinuation(Continuation* c) noexcept
+	{
+		auto* head = this->m_continuations.load(std::memory_order_acquire);
+		do {
+			if (head == TaskStateBase::completed()) {
+				c->invoke();
+				return;
+			}
+
+			c->next = head;
+		} while (!this->m_continuations.compare_exchange_weak(head, c, std::memory_order_release, std::memory_order_acquire));
+	}
+
+	void wait() noexcept
+	{
+		if (this->isReady()) {
+			return;
+		}
+
+		class Waiter : public Continuation {
+		public:
+			void invoke() noexcept override
+			{
+				const std::lock_guard<std::mutex> locker(this->mutex);
+				this->done = true;
+				this->cv.notify_all();
+			}
+
+			std::mutex mutex;
+			std::condition_variable cv;
+			bool done = false;
+		} waiter;
+
+		this->addContinuation(&waiter);
+
+		std::unique_lock<std::mutex> locker(waiter.mutex);
+		waiter.cv.wait(locker, [&waiter] { return waiter.done; });
+	}
+
+	const std::exception_ptr& exception() const noexcept { return this->m_exception; }
+
+	void setException(std::exception_ptr e) noexcept
+	{
+		this->m_exception = e;
+		this->complete();
+	}
+
+	void complete() noexcept
+	{
+		auto* head = this->m_continuations.exchange(TaskStateBase::completed(), std::memory_order_acq_rel);
+
+		Continuation* fifo = nullptr;
+		while (head) {
+			auto* next = head->next;
+			head->next = fifo;
+			fifo       = head;
+			head       = next;
+		}
+
+		while (fifo) {
+			auto* next = fifo->next;
+			fifo->invoke();
+			fifo = next;
+		}
+	}
+
+private:
+	static Continuation* completed() noexcept
+	{
+		static char marker;
+		return reinterpret_cast<Continuation*>(&marker);
+	}
+
+	std::atomic<Continuation*> m_continuations{nullptr};
+	std::exception_ptr m_exception;
+};
+
+template<typename T>
+class TaskState : public TaskStateBase {
+public:
+	using const_reference = const T&;
+
+	~TaskState() override
+	{
+		if (this->m_hasValue) {
+			reinterpret_cast<T*>(&this->m_storage)->~T();
+		}
+	}
+
+	template<typename U>
+	void emplace(U&& value)
+	{
+		new (&this->m_storage) T(std::forward<U>(value));
+		this->m_hasValue = true;
+	}
+
+	const_reference value() const noexcept { return *reinterpret_cast<const T*>(&this->m_storage); }
+
+private:
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+	bool m_hasValue = false;
+};
+
+template<>
+class TaskState<void> : public TaskStateBase {
+public:
+	using const_reference = void;
+
+	void value() const noexcept {}
+};
+
+template<typename F>
+class CallbackContinuation : public TaskStateBase::Continuation {
+public:
+	explicit CallbackContinuation(F f) : m_f(std::move(f)) {}
+
+	void invoke() noexcept override
+	{
+		this->m_f();
+		delete this;
+	}
+
+private:
+	F m_f;
+};
+
+template<typename F>
+TaskStateBase::Continuation* makeContinuation(F f)
+{
+	return new CallbackContinuation<F>(std::move(f));
+}
+
+template<typename T>
+struct TaskInvoker {
+	template<typename F>
+	static void call(TaskState<T>& state, F& f) { state.emplace(f()); }
+};
+
+template<>
+struct TaskInvoker<void> {
+	template<typename F>
+	static void call(TaskState<void>&, F& f) { f(); }
+};
+
+template<typename T, typename F>
+void runTask(TaskState<T>& state, F& f) noexcept
+{
+	try {
+		TaskInvoker<T>::call(state, f);
+	}
+	catch (...) {
+		state.setException(std::current_exception());
+		return;
+	}
+
+	state.complete();
+}
+
+template<typename T, typename F>
+class TaskRunnable : public Runnable {
+public:
+	TaskRunnable(std::shared_ptr<TaskState<T> > state, F f)
+		: m_state(std::move(state)), m_f(std::move(f))
+	{
+	}
+
+	~TaskRunnable() override
+	{
+		// Removed from the queue (clear(), cancel(), expired deadline) without ever running
+		if (this->m_state) {
+			this->m_state->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+		}
+	}
+
+	void run() override
+	{
+		auto state = std::move(this->m_state);
+		runTask(*state, this->m_f);
+	}
+
+	// For a task the pool refused to take: the handle gets `e` instead of a broken promise
+	void fail(std::exception_ptr e) noexcept
+	{
+		auto state = std::move(this->m_state);
+		state->setException(e);
+	}
+
+private:
+	std::shared_ptr<TaskState<T> > m_state;
+	F m_f;
+};
+
+template<typename T>
+class TaskHandle {
+public:
+	TaskHandle() = default;
+
+	bool valid() const noexcept { return this->m_state != nullptr; }
+	bool isReady() const noexcept { return this->m_state->isReady(); }
+	void wait() const noexcept { this->m_state->wait(); }
+
+	typename TaskState<T>::const_reference get() const
+	{
+		this->m_state->wait();
+		if (this->m_state->exception()) {
+			std::rethrow_exception(this->m_state->exception());
+		}
+
+		return this->m_state->value();
+	}
+
+	template<typename F>
+	TaskHandle<decltype(std::declval<F&>()(std::declval<TaskHandle<T>&>()))> then(F f, Launch launch = Launch::Async, int priority = 0) const;
+
+private:
+	template<typename U> friend class TaskHandle;
+	friend class ThreadPool;
+
+	template<typename U>
+	friend TaskHandle<std::vector<TaskHandle<U> > > whenAll(std::vector<TaskHandle<U> > tasks);
+
+	template<typename U>
+	friend TaskHandle<std::size_t> whenAny(const std::vector<TaskHandle<U> >& tasks);
+
+	TaskHandle(std::shared_ptr<TaskState<T> > state, ThreadPool* pool)
+		: m_state(std::move(state)), m_pool(pool)
+	{
+	}
+
+	std::shared_ptr<TaskState<T> > m_state;
+	ThreadPool* m_pool = nullptr;
+};
+
+template<typename T, typename F>
+struct ContinuationCall {
+	F f;
+	TaskHandle<T> antecedent;
+
+	auto operator()() -> decltype(f(antecedent)) { return this->f(this->antecedent); }
+};
+
+template<typename T>
+template<typename F>
+TaskHandle<decltype(std::declval<F&>()(std::declval<TaskHandle<T>&>()))> TaskHandle<T>::then(F f, Launch launch, int priority) const
+{
+	using R    = decltype(std::declval<F&>()(std::declval<TaskHandle<T>&>()));
+	using Call = ContinuationCall<T, F>;
+
+	auto state = std::make_shared<TaskState<R> >();
+	auto* pool = this->m_pool;
+	Call call  = { std::move(f), *this };
+
+	this->m_state->addContinuation(makeContinuation([state, pool, call, launch, priority]() mutable {
+		if (launch == Launch::Inline || !pool) {
+			runTask(*state, call);
+			return;
+		}
+
+		// This runs from complete(), which must not throw, and the returned handle still has to become ready
+		TaskRunnable<R, Call>* task = nullptr;
+		try {
+			task = new TaskRunnable<R, Call>(state, std::move(call));
+			pool->start(task, priority);
+		}
+		catch (...) {
+			if (task) {
+				task->fail(std::current_exception());
+				delete task;
+			}
+			else {
+				state->setException(std::current_exception());
+			}
+		}
+	}));
+
+	return TaskHandle<R>(state, pool);
+}
+
+template<typename T>
+TaskHandle<std::vector<TaskHandle<T> > > whenAll(std::vector<TaskHandle<T> > tasks)
+{
+	using Result = std::vector<TaskHandle<T> >;
+
+	struct Join {
+		std::atomic<std::size_t> remaining{0};
+		Result tasks;
+	};
+
+	auto state = std::make_shared<TaskState<Result> >();
+	auto* pool = tasks.empty() ? nullptr : tasks.front().m_pool;
+
+	if (tasks.empty()) {
+		state->emplace(Result());
+		state->complete();
+		return TaskHandle<Result>(state, pool);
+	}
+
+	auto join = std::make_shared<Join>();
+	join->remaining.store(tasks.size(), std::memory_order_relaxed);
+	join->tasks = tasks;
+
+	for (auto& task : tasks) {
+		task.m_state->addContinuation(makeContinuation([join, state]() {
+			if (join->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				state->emplace(std::move(join->tasks));
+				state->complete();
+			}
+		}));
+	}
+
+	return TaskHandle<Result>(state, pool);
+}
+
+template<typename T>
+TaskHandle<std::size_t> whenAny(const std::vector<TaskHandle<T> >& tasks)
+{
+	struct Race {
+		std::atomic<bool> done{false};
+	};
+
+	auto state = std::make_shared<TaskState<std::size_t> >();
+	auto* pool = tasks.empty() ? nullptr : tasks.front().m_pool;
+
+	if (tasks.empty()) {
+		state->emplace(ThreadPool::npos);
+		state->complete();
+		return TaskHandle<std::size_t>(state, pool);
+	}
+
+	auto race = std::make_shared<Race>();
+	for (std::size_t i = 0; i < tasks.size(); ++i) {
+		tasks[i].m_state->addContinuation(makeContinuation([race, state, i]() {
+			if (!race->done.exchange(true, std::memory_order_acq_rel)) {
+				state->emplace(i);
+				state->complete();
+			}
+		}));
+	}
+
+	return TaskHandle<std::size_t>(state, pool);
+}
+
+template<typename F>
+TaskHandle<decltype(std::declval<F&>()())> ThreadPool::submit(F f, int priority)
+{
+	using R = decltype(std::declval<F&>()());
+
+	auto state = std::make_shared<TaskState<R> >();
+	std::unique_ptr<TaskRunnable<R, F> > task(new TaskRunnable<R, F>(state, std::move(f)));
+	this->start(task.get(), priority);
+	task.release();
+	return TaskHandle<R>(state, this);
+}
+
+#endif // TASKHANDLE_H
@@ -0,0 +1,25 @@
+#ifndef TASKNODE_H
+#define TASKNODE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+class Runnable;
+
+struct TaskNode {
+	using clock = std::chrono::steady_clock;
+
+	// In a priority bucket `next` is the next task; in the deadline heap it is the next sibling
+	TaskNode* next     = nullptr;
+	TaskNode* child    = nullptr;
+	TaskNode* prev     = nullptr;
+	Runnable* runnable = nullptr;
+	clock::time_point enqueued;
+	clock::time_point deadline = clock::time_point::max();
+	int priority = 0;
+	std::size_t bytes = 0;
+	std::uint64_t seq = 0;
+};
+
+#endif // TASKNODE_H
@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include "taskqueue.h"
+#include "runnable.h"
+
+namespace {
+
+// Empty buckets beyond this many are freed, so that a wide spread of priorities does not grow the map forever
+const std::size_t max_buckets = 16;
+
+}
+
+void TaskQueue::List::append(TaskNode* node) noexcept
+{
+	node->next = nullptr;
+	if (this->tail) {
+		this->tail->next = node;
+	}
+	else {
+		this->head = node;
+	}
+
+	this->tail = node;
+}
+
+void TaskQueue::List::unlink(TaskNode* node, TaskNode* prev) noexcept
+{
+	if (prev) {
+		prev->next = node->next;
+	}
+	else {
+		this->head = node->next;
+	}
+
+	if (this->tail == node) {
+		this->tail = prev;
+	}
+
+	node->next = nullptr;
+}
+
+TaskNode* TaskQueue::List::find(const Runnable* runnable, TaskNode** prev) const noexcept
+{
+	*prev = nullptr;
+	for (auto* node = this->head; node; node = node->next) {
+		if (node->runnable == runnable) {
+			return node;
+		}
+
+		*prev = node;
+	}
+
+	return nullptr;
+}
+
+bool TaskQueue::Heap::earlier(const TaskNode* a, const TaskNode* b) noexcept
+{
+	// Equal deadlines keep their submission order
+	return a->deadline < b->deadline || (a->deadline == b->deadline && a->seq < b->seq);
+}
+
+TaskNode* TaskQueue::Heap::meld(TaskNode* a, TaskNode* b) noexcept
+{
+	if (Heap::earlier(b, a)) {
+		std::swap(a, b);
+	}
+
+	b->prev = a;
+	b->next = a->child;
+	if (a->child) {
+		a->child->prev = b;
+	}
+
+	a->child = b;
+	return a;
+}
+
+TaskNode* TaskQueue::Heap::mergePairs(TaskNode* first) noexcept
+{
+	// Two-pass pairing: meld neighbours left to right, then fold the results right to left
+	TaskNode* pairs = nullptr;
+	while (first) {
+		auto* a = first;
+		auto* b = a->next;
+		first   = b ? b->next : nullptr;
+
+		a->next = a->prev = nullptr;
+		if (b) {
+			b->next = b->prev = nullptr;
+			a = Heap::meld(a, b);
+		}
+
+		a->next = pairs;
+		pairs   = a;
+	}
+
+	TaskNode* root = nullptr;
+	while (pairs) {
+		auto* next  = pairs->next;
+		pairs->next = nullptr;
+		root        = root ? Heap::meld(root, pairs) : pairs;
+		pairs       = next;
+	}
+
+	return root;
+}
+
+TaskNode* TaskQueue::Heap::parent(TaskNode* node) noexcept
+{
+	while (node->prev && node->prev->child != node) {
+		node = node->prev;
+	}
+
+	return node->prev;
+}
+
+void TaskQueue::Heap::insert(TaskNode* node) noexcept
+{
+	node->next = node->prev = node->child = nullptr;
+	this->head = this->head ? Heap::meld(this->head, node) : node;
+}
+
+void TaskQueue::Heap::unlink(TaskNode* node) noexcept
+{
+	if (node == this->head) {
+		this->head = Heap::mergePairs(node->child);
+	}
+	else {
+		if (node->prev->child == node) {
+			node->prev->child = node->next;
+		}
+		else {
+			node->prev->next = node->next;
+		}
+
+		if (node->next) {
+			node->next->prev = node->prev;
+		}
+
+		auto* sub = Heap::mergePairs(node->child);
+		if (sub) {
+			this->head = Heap::meld(this->head, sub);
+		}
+	}
+
+	node->next = node->prev = node->child = nullptr;
+}
+
+TaskNode* TaskQueue::Heap::find(const Runnable* runnable) const noexcept
+{
+	// Depth-first walk over the tree without a stack: down through children, then on to the next sibling
+	auto* node = this->head;
+	while (node) {
+		if (node->runnable == runnable) {
+			return node;
+		}
+
+		if (node->child) {
+			node = node->child;
+			continue;
+		}
+
+		while (node && !node->next) {
+			node = Heap::parent(node);
+		}
+
+		node = node ? node->next : nullptr;
+	}
+
+	return nullptr;
+}
+
+TaskQueue::~TaskQueue()
+{
+	this->clear([](Runnable*) {});
+}
+
+TaskNode* TaskQueue::acquire(Runnable* runnable)
+{
+	auto* node = !runnable->m_nodeInUse.exchange(true, std::memory_order_acquire) ? &runnable->m_node : new TaskNode();
+	node->runnable = runnable;
+	runnable->m_queued.fetch_add(1, std::memory_order_relaxed);
+	return node;
+}
+
+Runnable* TaskQueue::release(TaskNode* node) noexcept
+{
+	auto* runnable = node->runnable;
+	if (node == &runnable->m_node) {
+		runnable->m_nodeInUse.store(false, std::memory_order_release);
+	}
+	else {
+		delete node;
+	}
+
+	runnable->m_queued.fetch_sub(1, std::memory_order_relaxed);
+	return runnable;
+}
+
+void TaskQueue::push(Runnable* runnable, int priority, clock::time_point deadline, std::size_t bytes)
+{
+	auto* node     = TaskQueue::acquire(runnable);
+	node->priority = priority;
+	node->deadline = deadline;
+	node->bytes    = bytes;
+	++this->m_size;
+	this->m_bytes += bytes;
+
+	// The new task may outrank whatever front() picked
+	this->forget();
+
+	if (deadline != clock::time_point::max()) {
+		node->seq = this->m_deadlineSeq++;
+		this->m_deadlines.insert(node);
+		return;
+	}
+
+	node->enqueued = this->m_agingInterval ? clock::now() : clock::time_point();
+	this->m_buckets[priority].append(node);
+}
+
+Runnable* TaskQueue::front()
+{
+	// Always picked afresh (aging may have changed the order since the last call); pop_front() reuses the pick
+	this->pick();
+	return this->m_pickedDeadline ? this->m_deadlines.head->runnable : this->m_selected->second.head->runnable;
+}
+
+void TaskQueue::pop_front()
+{
+	if (!this->m_picked) {
+		this->pick();
+	}
+
+	TaskNode* node;
+	if (this->m_pickedDeadline) {
+		node = this->m_deadlines.head;
+		this->m_deadlines.unlink(node);
+	}
+	else {
+		auto it = this->m_selected;
+		node    = it->second.head;
+		it->second.unlink(node, nullptr);
+		this->bucketDrained(it);
+	}
+
+	this->forget();
+
+	this->m_bytes -= node->bytes;
+	TaskQueue::release(node);
+	--this->m_size;
+}
+
+bool TaskQueue::remove(const Runnable* runnable)
+{
+	if (!runnable->isQueued()) {
+		return false;
+	}
+
+	auto* node = this->m_deadlines.find(runnable);
+	if (node) {
+		this->m_deadlines.unlink(node);
+	}
+	else {
+		TaskNode* prev;
+		for (auto it = this->m_buckets.begin(); it != this->m_buckets.end(); ++it) {
+			node = it->second.find(runnable, &prev);
+			if (node) {
+				it->second.unlink(node, prev);
+				this->bucketDrained(it);
+				break;
+			}
+		}
+	}
+
+	if (!node) {
+		return false;
+	}
+
+	this->forget();
+	this->m_bytes -= node->bytes;
+	TaskQueue::release(node);
+	--this->m_size;
+	return true;
+}
+
+void TaskQueue::setAging(unsigned long int interval, int cap) noexcept
+{
+	this->m_agingInterval = interval;
+	this->m_agingCap      = cap > 0 ? cap : 0;
+	this->forget();
+}
+
+void TaskQueue::pick()
+{
+	this->m_selected = this->select();
+	this->m_picked   = true;
+
+	// Deadline tasks go first, except over a task that has already gained the full aging boost: without that, a
+	// steady stream of deadline tasks would keep everything else waiting forever
+	this->m_pickedDeadline = this->m_deadlines.head && (this->m_selected == this->m_buckets.end() || !this->agedOut(this->m_selected->second.head));
+}
+
+bool TaskQueue::agedOut(const TaskNode* node) const
+{
+	if (!this->m_agingInterval || !this->m_agingCap || node->enqueued == clock::time_point()) {
+		return false;
+	}
+
+	return clock::now() - node->enqueued >= std::chrono::milliseconds(this->m_agingInterval) * this->m_agingCap;
+}
+
+void TaskQueue::bucketDrained(Buckets::iterator it)
+{
+	if (!it->second.head && this->m_buckets.size() > max_buckets) {
+		this->m_buckets.erase(it);
+	}
+}
+
+TaskQueue::Buckets::iterator TaskQueue::select()
+{
+	auto best = this->m_buckets.begin();
+	while (best != this->m_buckets.end() && !best->second.head) {
+		++best;
+	}
+
+	if (!this->m_agingInterval || !this->m_agingCap || best == this->m_buckets.end()) {
+		return best;
+	}
+
+	const auto now      = clock::now();
+	const auto interval = std::chrono::milliseconds(this->m_agingInterval);
+	const auto cap      = static_cast<long long int>(this->m_agingCap);
+	auto effective      = [now, interval, cap](int priority, const TaskNode* head) -> long long int {
+		long long int boost = 0;
+		if (head->enqueued != clock::time_point()) {
+			boost = std::min<long long int>((now - head->enqueued) / interval, cap);
+		}
+
+		return priority + boost;
+	};
+
+	auto best_priority = effective(best->first, best->second.head);
+	for (auto it = std::next(best); it != this->m_buckets.end(); ++it) {
+		// Buckets are sorted by descending base priority: once even a fully aged task cannot win, stop looking
+		if (it->first + cap <= best_priority) {
+			break;
+		}
+
+		if (!it->second.head) {
+			continue;
+		}
+
+		const auto priority = effective(it->first, it->second.head);
+		if (priority > best_priority) {
+			best          = it;
+			best_priority = priority;
+		}
+	}
+
+	return best;
+}
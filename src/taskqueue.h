@@ -0,0 +1,162 @@
+#ifndef TASKQUEUE_H
+#define TASKQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include "tasknode.h"
+
+class Runnable;
+
+/*
+ * Priority queue of pending tasks: one FIFO bucket per priority level,
+ * highest priority first. With aging enabled, a task gains one priority
+ * level per `agingInterval` milliseconds spent in the queue (up to
+ * `agingCap` levels). Since the head of a bucket is always its oldest
+ * entry, only bucket heads need to be compared on dequeue, and nothing
+ * is ever re-sorted.
+ *
+ * Tasks submitted with a deadline are kept in a separate lane (an
+ * intrusive pairing heap ordered by deadline, then by submission) and
+ * are dispatched before priority tasks (earliest deadline
+ * first). The exception is a priority task that has been waiting for
+ * agingInterval * agingCap ms: it goes before the deadline lane, so that
+ * with aging enabled deadline tasks cannot starve the rest. Without
+ * aging, a steady stream of deadline tasks does starve priority tasks.
+ *
+ * Every entry may carry a byte cost (memory pinned by the task until it
+ * runs); bytes() is the sum over everything queued.
+ *
+ * Entries are intrusive: a task uses the TaskNode embedded in its
+ * Runnable, and a node is only allocated when the same task is queued
+ * several times at once. Empty buckets are kept around so that a steady
+ * stream of submissions does not allocate at all.
+ */
+class TaskQueue {
+public:
+	using clock = TaskNode::clock;
+
+	TaskQueue() = default;
+	~TaskQueue();
+
+	TaskQueue(const TaskQueue&) = delete;
+	TaskQueue& operator=(const TaskQueue&) = delete;
+
+	void push(Runnable* runnable, int priority, clock::time_point deadline = clock::time_point::max(), std::size_t bytes = 0);
+
+	Runnable* front();
+	void pop_front();
+
+	bool empty() const noexcept { return this->m_size == 0; }
+	std::size_t size() const noexcept { return this->m_size; }
+	std::size_t bytes() const noexcept { return this->m_bytes; }
+
+	bool remove(const Runnable* runnable);
+
+	template<typename F>
+	std::size_t dropExpired(clock::time_point now, F f)
+	{
+		std::size_t n = 0;
+		while (this->m_deadlines.head && this->m_deadlines.head->deadline <= now) {
+			this->forget();
+			auto* node = this->m_deadlines.head;
+			this->m_deadlines.unlink(node);
+			--this->m_size;
+			this->m_bytes -= node->bytes;
+			++n;
+			f(TaskQueue::release(node));
+		}
+
+		return n;
+	}
+
+	template<typename F>
+	void clear(F f)
+	{
+		while (this->m_deadlines.head) {
+			auto* node = this->m_deadlines.head;
+			this->m_deadlines.unlink(node);
+			f(TaskQueue::release(node));
+		}
+
+		for (auto& bucket : this->m_buckets) {
+			TaskQueue::clear(bucket.second, f);
+		}
+
+		this->m_buckets.clear();
+		this->forget();
+		this->m_size     = 0;
+		this->m_bytes    = 0;
+	}
+
+	unsigned long int agingInterval() const noexcept { return this->m_agingInterval; }
+	int agingCap() const noexcept { return this->m_agingCap; }
+	void setAging(unsigned long int interval, int cap) noexcept;
+
+private:
+	struct List {
+		TaskNode* head = nullptr;
+		TaskNode* tail = nullptr;
+
+		void append(TaskNode* node) noexcept;
+		void unlink(TaskNode* node, TaskNode* prev) noexcept;
+		TaskNode* find(const Runnable* runnable, TaskNode** prev) const noexcept;
+	};
+
+	// Pushing is O(1) and removing any node O(log n) amortized, without allocating; `head` is the earliest deadline
+	struct Heap {
+		TaskNode* head = nullptr;
+
+		void insert(TaskNode* node) noexcept;
+		void unlink(TaskNode* node) noexcept;
+		TaskNode* find(const Runnable* runnable) const noexcept;
+
+		static bool earlier(const TaskNode* a, const TaskNode* b) noexcept;
+		static TaskNode* meld(TaskNode* a, TaskNode* b) noexcept;
+		static TaskNode* mergePairs(TaskNode* first) noexcept;
+		static TaskNode* parent(TaskNode* node) noexcept;
+	};
+
+	using Buckets = std::map<int, List, std::greater<int> >;
+
+	static TaskNode* acquire(Runnable* runnable);
+	static Runnable* release(TaskNode* node) noexcept;
+
+	template<typename F>
+	static void clear(List& list, F f)
+	{
+		auto* node = list.head;
+		while (node) {
+			auto* next = node->next;
+			f(TaskQueue::release(node));
+			node = next;
+		}
+
+		list.head = list.tail = nullptr;
+	}
+
+	Buckets::iterator select();
+	void pick();
+	bool agedOut(const TaskNode* node) const;
+	void bucketDrained(Buckets::iterator it);
+
+	void forget() noexcept
+	{
+		this->m_selected = this->m_buckets.end();
+		this->m_picked   = false;
+	}
+
+	Heap m_deadlines;
+	std::uint64_t m_deadlineSeq = 0;
+	Buckets m_buckets;
+	Buckets::iterator m_selected = m_buckets.end();
+	bool m_picked         = false;
+	bool m_pickedDeadline = false;
+	std::size_t m_size = 0;
+	std::size_t m_bytes = 0;
+	unsigned long int m_agingInterval = 0;
+	int m_agingCap = 0;
+};
+
+#endif // TASKQUEUE_H
@@ -1,8 +1,13 @@
+#include <atomic>
 #include <mutex>
 #include "threadpool.h"
 #include "threadpool_p.h"
 #include "threadpoolthread.h"
 #include "runnable.h"
+#include "tracer.h"
+#include "waitfreeproducer.h"
+
+const std::size_t ThreadPool::npos;
 
 ThreadPool::ThreadPool()
 	: d_ptr(new ThreadPoolPrivate())
@@ -11,7 +16,15 @@ ThreadPool::ThreadPool()
 
 ThreadPool::~ThreadPool()
 {
+	{
+		auto* d = this->d_func();
+		const std::unique_lock<std::mutex> locker(d->mutex);
+		d->reactor.clear();
+	}
+
+	this->resume();
 	this->waitForDone();
+	this->setWorkerBudget(nullptr);
 }
 
 void ThreadPool::start(Runnable* runnable, int priority)
@@ -20,19 +33,59 @@ void ThreadPool::start(Runnable* runnable, int priority)
 		return;
 	}
 
+	trace(TraceEvent::Enqueue, runnable);
+
 	auto* d = this->d_func();
 	std::unique_lock<std::mutex> locker(d->mutex);
-	if (!d->tryStart(runnable)) {
-		d->enqueueTask(runnable, priority);
+	auto* wake = d->submit(runnable, priority, ThreadPoolPrivate::clock::time_point::max());
+	locker.unlock();
 
-		if (!d->waitingThreads.empty()) {
-			auto* t = d->waitingThreads.front();
-			d->waitingThreads.pop_front();
-			t->runnableReady.notify_one();
-		}
+	if (wake) {
+		wake->wake();
+	}
+}
+
+void ThreadPool::start(Runnable* runnable, std::chrono::steady_clock::time_point deadline)
+{
+	if (!runnable) {
+		return;
+	}
+
+	trace(TraceEvent::Enqueue, runnable);
+
+	auto* d = this->d_func();
+	std::unique_lock<std::mutex> locker(d->mutex);
+	auto* wake = d->submit(runnable, 0, deadline);
+	locker.unlock();
+
+	if (wake) {
+		wake->wake();
 	}
 }
 
+bool ThreadPool::startBounded(Runnable* runnable, std::size_t bytes, int priority, unsigned long int timeout)
+{
+	if (!runnable) {
+		return false;
+	}
+
+	auto* d = this->d_func();
+	std::unique_lock<std::mutex> locker(d->mutex);
+	if (!d->waitForQueueSpace(locker, bytes, timeout)) {
+		return false;
+	}
+
+	trace(TraceEvent::Enqueue, runnable);
+	auto* wake = d->submit(runnable, priority, ThreadPoolPrivate::clock::time_point::max(), bytes);
+	locker.unlock();
+
+	if (wake) {
+		wake->wake();
+	}
+
+	return true;
+}
+
 bool ThreadPool::tryStart(Runnable* runnable)
 {
 	if (!runnable) {
@@ -42,13 +95,59 @@ bool ThreadPool::tryStart(Runnable* runnable)
 	auto* d = this->d_func();
 	std::unique_lock<std::mutex> locker(d->mutex);
 
-	if (d->allThreads.empty() && d->activeThreadCount() >= d->maxThreadCount) {
+	if (d->paused || (d->allThreads.empty() && d->activeThreadCount() >= d->maxThreadCount)) {
 		return false;
 	}
 
 	return d->tryStart(runnable);
 }
 
+bool ThreadPool::trySubmitWaitFree(WaitFreeProducer* producer, Runnable* runnable, int priority) noexcept
+{
+	auto* d = this->d_func();
+	if (!runnable || producer->d != d || !producer->push(runnable, priority)) {
+		return false;
+	}
+
+	// Not traced: the tracer may allocate a buffer for a new thread
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	d->doorbell.notify();
+	return true;
+}
+
+bool ThreadPool::watch(int fd, unsigned int events, IoCallback callback)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	if (!callback || !d->reactor.add(fd, events, std::move(callback))) {
+		return false;
+	}
+
+	// A poller parked on the doorbell alone has to start waiting on the epoll set
+	if (d->poller) {
+		d->doorbell.ring();
+	}
+	else {
+		d->startPoller();
+	}
+
+	return true;
+}
+
+bool ThreadPool::unwatch(int fd)
+{
+	auto* d = this->d_func();
+	std::unique_lock<std::mutex> locker(d->mutex);
+	auto reg = d->reactor.remove(fd);
+	if (!reg) {
+		return false;
+	}
+
+	auto* self = ThreadPoolThread::current();
+	d->ioDone.wait(locker, [&reg, self] { return !reg->runner || reg->runner == self; });
+	return true;
+}
+
 unsigned long int ThreadPool::expiryTimeout() const
 {
 	return this->d_func()->expiryTimeout;
@@ -59,14 +158,121 @@ void ThreadPool::setExpiryTimeout(unsigned long int v)
 	this->d_func()->expiryTimeout = v;
 }
 
+unsigned long int ThreadPool::priorityAgingInterval() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->queue.agingInterval();
+}
+
+int ThreadPool::priorityAgingCap() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->queue.agingCap();
+}
+
+void ThreadPool::setPriorityAging(unsigned long int interval, int cap)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->queue.setAging(interval, cap);
+}
+
+bool ThreadPool::dropExpiredTasks() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->dropExpired;
+}
+
+void ThreadPool::setDropExpiredTasks(bool v)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->dropExpired = v;
+}
+
+bool ThreadPool::inlineDispatch() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->inlineDispatch;
+}
+
+void ThreadPool::setInlineDispatch(bool v)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->inlineDispatch = v;
+}
+
+void ThreadPool::setExceptionHandler(ExceptionHandler handler)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->exceptionHandler = std::move(handler);
+}
+
+void ThreadPool::setThreadStartHook(ThreadHook hook)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->threadStartHook = std::move(hook);
+}
+
+void ThreadPool::setThreadExitHook(ThreadHook hook)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->threadExitHook = std::move(hook);
+}
+
+std::size_t ThreadPool::currentWorkerIndex() noexcept
+{
+	const auto* t = ThreadPoolThread::current();
+	return t ? t->index : ThreadPool::npos;
+}
+
+std::size_t ThreadPool::stackSize() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->stackSize;
+}
+
+void ThreadPool::setStackSize(std::size_t bytes)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->stackSize = bytes;
+}
+
+unsigned int ThreadPool::stackFlags() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->stackFlags;
+}
+
+void ThreadPool::setStackFlags(unsigned int flags)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->stackFlags = flags;
+}
+
 std::size_t ThreadPool::maxThreadCount() const
 {
-	return this->d_func()->maxThreadCount;
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->maxThreadCount;
 }
 
 void ThreadPool::setMaxThreadCount(std::size_t n)
 {
 	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
 	if (d->maxThreadCount == n) {
 		return;
 	}
@@ -75,6 +281,40 @@ void ThreadPool::setMaxThreadCount(std::size_t n)
 	d->tryToStartMoreThreads();
 }
 
+bool ThreadPool::setWorkerBudget(WorkerBudget* budget, std::size_t minimum, std::size_t maximum)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	if (!d->setBudget(budget, minimum, maximum)) {
+		return false;
+	}
+
+	d->tryToStartMoreThreads();
+	return true;
+}
+
+WorkerBudget* ThreadPool::workerBudget() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->budget;
+}
+
+std::size_t ThreadPool::maxQueuedBytes() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->maxQueuedBytes;
+}
+
+void ThreadPool::setMaxQueuedBytes(std::size_t bytes)
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->maxQueuedBytes = bytes;
+	d->queueSpace.notify_all();
+}
+
 std::size_t ThreadPool::activeThreadCount() const
 {
 	auto* d = this->d_func();
@@ -87,11 +327,26 @@ std::size_t ThreadPool::queueSize() const
 	return this->d_func()->queue.size();
 }
 
+ThreadPoolStats ThreadPool::stats() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+
+	ThreadPoolStats stats;
+	stats.activeThreads = d->activeThreadCount();
+	stats.queuedTasks   = d->queue.size();
+	stats.queuedBytes   = d->queue.bytes();
+	stats.expiredTasks  = d->expiredTasks;
+	stats.failedTasks   = d->failedTasks;
+	return stats;
+}
+
 void ThreadPool::reserveThread()
 {
 	auto* d = this->d_func();
 	const std::unique_lock<std::mutex> locker(d->mutex);
 	++d->reservedThreads;
+	d->syncBudget();
 }
 
 void ThreadPool::releaseThread()
@@ -99,6 +354,7 @@ void ThreadPool::releaseThread()
 	auto* d = this->d_func();
 	const std::unique_lock<std::mutex> locker(d->mutex);
 	--d->reservedThreads;
+	d->syncBudget();
 	d->tryToStartMoreThreads();
 }
 
@@ -113,6 +369,39 @@ bool ThreadPool::waitForDone(unsigned long int msec)
 	return ret;
 }
 
+void ThreadPool::pause()
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	d->paused = true;
+}
+
+void ThreadPool::resume()
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	if (d->paused) {
+		d->paused = false;
+		d->tryToStartMoreThreads();
+
+		if (d->poller && (!d->reactor.empty() || !d->producersIdle())) {
+			d->doorbell.ring();
+		}
+	}
+}
+
+bool ThreadPool::isPaused() const
+{
+	auto* d = this->d_func();
+	const std::unique_lock<std::mutex> locker(d->mutex);
+	return d->paused;
+}
+
+bool ThreadPool::drain(unsigned long int msec)
+{
+	return this->d_func()->drain(msec);
+}
+
 void ThreadPool::clear()
 {
 	this->d_func()->clear();
@@ -125,7 +414,7 @@ void ThreadPool::cancel(Runnable* runnable)
 		return;
 	}
 
-	if (runnable->autoDelete() && !--runnable->m_ref) {
+	if (runnable->deref()) {
 		delete runnable;
 	}
 }
@@ -1,39 +1,135 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <chrono>
+#include <exception>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <utility>
 
 class Runnable;
 class ThreadPoolPrivate;
+class WaitFreeProducer;
+class WorkerBudget;
+
+template<typename T> class TaskHandle;
+
+struct ThreadPoolStats {
+	std::size_t activeThreads = 0;
+	std::size_t queuedTasks   = 0;
+	std::size_t queuedBytes   = 0;
+	std::size_t expiredTasks  = 0;
+	std::size_t failedTasks   = 0;
+};
 
 class ThreadPool {
 public:
+	using ExceptionHandler = std::function<void(Runnable*, std::exception_ptr)>;
+	using ThreadHook       = std::function<void(std::size_t)>;
+	using IoCallback       = std::function<void(int, unsigned int)>;
+
+	static const std::size_t npos = static_cast<std::size_t>(-1);
+
+	enum StackFlag : unsigned int {
+		StackDefault   = 0,
+		StackPrefault  = 1,
+		StackHugePages = 2
+	};
+
+	enum IoEvent : unsigned int {
+		IoRead   = 1,
+		IoWrite  = 2,
+		IoHangup = 4
+	};
+
 	ThreadPool();
 	~ThreadPool();
 
 	void start(Runnable* runnable, int priority = 0);
+	void start(Runnable* runnable, std::chrono::steady_clock::time_point deadline);
 	bool tryStart(Runnable* runnable);
 
+	// `bytes` (memory pinned by the task) counts against maxQueuedBytes() while the task is queued. Waits up to
+	// `timeout` ms for room; on false the task was not taken and still belongs to the caller
+	bool startBounded(Runnable* runnable, std::size_t bytes, int priority = 0, unsigned long int timeout = std::numeric_limits<unsigned long int>::max());
+
+	// Never blocks or allocates: safe from real-time threads and signal handlers; false if the ring is full
+	bool trySubmitWaitFree(WaitFreeProducer* producer, Runnable* runnable, int priority = 0) noexcept;
+
+	// Runs `callback(fd, events)` on a worker whenever `fd` becomes ready (Linux only); never concurrently for one fd
+	bool watch(int fd, unsigned int events, IoCallback callback);
+	// Waits for a running callback to return, unless called from that callback
+	bool unwatch(int fd);
+
+	// Defined in taskhandle.h
+	template<typename F>
+	TaskHandle<decltype(std::declval<F&>()())> submit(F f, int priority = 0);
+
 	unsigned long int expiryTimeout() const;
 	void setExpiryTimeout(unsigned long int v);
 
+	unsigned long int priorityAgingInterval() const;
+	int priorityAgingCap() const;
+	void setPriorityAging(unsigned long int interval, int cap);
+
+	bool dropExpiredTasks() const;
+	void setDropExpiredTasks(bool v);
+
+	// A task started from one of this pool's workers runs on that worker right after the current task
+	bool inlineDispatch() const;
+	void setInlineDispatch(bool v);
+
+	void setExceptionHandler(ExceptionHandler handler);
+
+	// Called on the worker thread itself with its index; must not call back into the pool
+	void setThreadStartHook(ThreadHook hook);
+	void setThreadExitHook(ThreadHook hook);
+	static std::size_t currentWorkerIndex() noexcept;
+
+	std::size_t stackSize() const;
+	void setStackSize(std::size_t bytes);
+
+	unsigned int stackFlags() const;
+	void setStackFlags(unsigned int flags);
+
 	std::size_t maxThreadCount() const;
 	void setMaxThreadCount(std::size_t n);
 
+	// npos means no limit
+	std::size_t maxQueuedBytes() const;
+	void setMaxQueuedBytes(std::size_t bytes);
+
+	// Active workers also hold a token from `budget`: `minimum` (at least 1) of them are guaranteed, up to `maximum` can be borrowed.
+	// Fails when `minimum` tokens are not free right now, including when they are only lent to another pool
+	bool setWorkerBudget(WorkerBudget* budget, std::size_t minimum = 1, std::size_t maximum = npos);
+	WorkerBudget* workerBudget() const;
+
 	std::size_t activeThreadCount() const;
 	std::size_t queueSize() const;
+	ThreadPoolStats stats() const;
 
 	void reserveThread();
 	void releaseThread();
 
 	bool waitForDone(unsigned long int timeout = std::numeric_limits<unsigned long int>::max());
 
+	// Workers finish their current task and then leave the queue alone until resume(); submissions are still accepted
+	void pause();
+	void resume();
+	bool isPaused() const;
+
+	// Like waitForDone(), but keeps the threads; a paused pool is drained once the running tasks are done
+	bool drain(unsigned long int timeout = std::numeric_limits<unsigned long int>::max());
+
 	void clear();
 	void cancel(Runnable* runnable);
 
 private:
 	friend class ThreadPoolPrivate;
+	friend class ShardedThreadPool;
+	friend class Strand;
+	friend class WaitFreeProducer;
 
 	const std::unique_ptr<ThreadPoolPrivate> d_ptr;
 
@@ -41,4 +137,6 @@ private:
 	inline const ThreadPoolPrivate* d_func() const { return this->d_ptr.get(); }
 };
 
+#include "taskhandle.h"
+
 #endif // THREADPOOL_H
@@ -1,31 +1,82 @@
 #include <algorithm>
 #include <chrono>
+#include <system_error>
 #include <thread>
 #include "threadpool_p.h"
 #include "threadpoolthread.h"
 #include "runnable.h"
+#include "tracer.h"
+#include "waitfreeproducer.h"
+#include "workerbudget.h"
 
 ThreadPoolPrivate::ThreadPoolPrivate()
 	: maxThreadCount(std::max(std::thread::hardware_concurrency(), 1u))
 {
 }
 
-bool ThreadPoolPrivate::tryStart(Runnable* task)
+Parker* ThreadPoolPrivate::submit(Runnable* runnable, int priority, clock::time_point deadline, std::size_t bytes)
+{
+	if (this->dropExpired && deadline != clock::time_point::max() && deadline <= clock::now()) {
+		runnable->ref();
+
+		++this->expiredTasks;
+		this->discardTask(runnable);
+		return nullptr;
+	}
+
+	if (this->paused) {
+		this->enqueueTask(runnable, priority, deadline, bytes);
+		return nullptr;
+	}
+
+	// A displaced run-next task goes back to the queue without its cost, so costed tasks never take the slot
+	if (this->inlineDispatch && deadline == clock::time_point::max() && !bytes && !this->isExiting) {
+		auto* self = ThreadPoolThread::current();
+		if (self && self->manager == this) {
+			this->setRunNext(self, runnable, priority);
+			return nullptr;
+		}
+	}
+
+	// The woken worker would only block on the lock the submitter still holds
+	this->deferWakeups = true;
+	bool started;
+	try {
+		started = this->tryStart(runnable, priority, deadline, bytes);
+	}
+	catch (...) {
+		this->deferWakeups = false;
+		throw;
+	}
+
+	if (!started) {
+		this->enqueueTask(runnable, priority, deadline, bytes);
+
+		if (!this->waitingThreads.empty() && (!this->budget || this->canActivateThread())) {
+			this->wakeWaitingThread();
+		}
+	}
+
+	auto* wake         = this->deferredWake;
+	this->deferWakeups = false;
+	this->deferredWake = nullptr;
+	return wake;
+}
+
+bool ThreadPoolPrivate::tryStart(Runnable* task, int priority, clock::time_point deadline, std::size_t bytes)
 {
 	if (this->allThreads.empty()) {
 		this->startThread(task);
 		return true;
 	}
 
-	if (this->activeThreadCount() >= this->maxThreadCount) {
+	if (!this->canActivateThread()) {
 		return false;
 	}
 
 	if (this->waitingThreads.size()) {
-		this->enqueueTask(task);
-		auto* t = this->waitingThreads.front();
-		this->waitingThreads.pop_front();
-		t->runnableReady.notify_one();
+		this->enqueueTask(task, priority, deadline, bytes);
+		this->wakeWaitingThread();
 		return true;
 	}
 
@@ -34,14 +85,25 @@ bool ThreadPoolPrivate::tryStart(Runnable* task)
 		this->expiredThreads.pop_front();
 
 		++this->activeThreads;
+		this->syncBudget();
 
-		if (task->autoDelete()) {
-			++task->m_ref;
+		if (task) {
+			task->ref();
 		}
 
+		trace(TraceEvent::Spawn, task);
 		t->runnable = task;
-		t->thread.join();
-		t->thread = std::thread(&ThreadPoolThread::operator(), t);
+		t->join();
+		try {
+			t->launch(this->stackSize, this->stackFlags);
+		}
+		catch (...) {
+			t->runnable = nullptr;
+			this->expiredThreads.push_front(t);
+			this->launchFailed(task);
+			throw;
+		}
+
 		return true;
 	}
 
@@ -49,24 +111,92 @@ bool ThreadPoolPrivate::tryStart(Runnable* task)
 	return true;
 }
 
-inline bool operator<(int priority, const std::pair<Runnable*, int>& p)
+void ThreadPoolPrivate::enqueueTask(Runnable* runnable, int priority, clock::time_point deadline, std::size_t bytes)
 {
-	return p.second < priority;
+	runnable->ref();
+
+	this->queue.push(runnable, priority, deadline, bytes);
 }
 
-inline bool operator<(const std::pair<Runnable*, int>&p, int priority)
+bool ThreadPoolPrivate::waitForQueueSpace(std::unique_lock<std::mutex>& locker, std::size_t bytes, unsigned long int msecs)
 {
-	return priority < p.second;
+	// A task costing more than the whole budget would never fit
+	auto fits = [this, bytes] {
+		return bytes <= this->maxQueuedBytes && this->queue.bytes() <= this->maxQueuedBytes - bytes;
+	};
+
+	if (fits() || !msecs || bytes > this->maxQueuedBytes) {
+		return fits();
+	}
+
+	++this->queueSpaceWaiters;
+	if (msecs == std::numeric_limits<unsigned long int>::max()) {
+		this->queueSpace.wait(locker, fits);
+	}
+	else {
+		this->queueSpace.wait_for(locker, std::chrono::milliseconds(msecs), fits);
+	}
+
+	--this->queueSpaceWaiters;
+	return fits();
 }
 
-void ThreadPoolPrivate::enqueueTask(Runnable* runnable, int priority)
+void ThreadPoolPrivate::notifyQueueSpace()
 {
-	if (runnable->autoDelete()) {
-		++runnable->m_ref;
+	if (this->queueSpaceWaiters) {
+		this->queueSpace.notify_all();
 	}
+}
+
+void ThreadPoolPrivate::setRunNext(ThreadPoolThread* thread, Runnable* runnable, int priority)
+{
+	runnable->ref();
+
+	auto* displaced               = thread->runNext;
+	const auto displaced_priority = thread->runNextPriority;
 
-	auto it = std::upper_bound(this->queue.begin(), this->queue.end(), priority);
-	this->queue.insert(it, std::make_pair(runnable, priority));
+	thread->runNext         = runnable;
+	thread->runNextPriority = priority;
+
+	// Only the most recent task keeps the slot; the one it replaces is queued as if submitted normally
+	if (displaced) {
+		this->queue.push(displaced, displaced_priority);
+		if (!this->waitingThreads.empty() && this->canActivateThread()) {
+			this->wakeWaitingThread();
+		}
+	}
+}
+
+void ThreadPoolPrivate::dropExpiredTasks()
+{
+	if (this->dropExpired) {
+		this->expiredTasks += this->queue.dropExpired(clock::now(), [this](Runnable* r) {
+			this->discardTask(r);
+		});
+
+		this->notifyQueueSpace();
+	}
+}
+
+void ThreadPoolPrivate::discardTask(Runnable* runnable)
+{
+	if (runnable->deref()) {
+		delete runnable;
+	}
+}
+
+void ThreadPoolPrivate::taskFailed(Runnable* runnable, std::exception_ptr e)
+{
+	std::function<void(Runnable*, std::exception_ptr)> handler;
+	{
+		const std::unique_lock<std::mutex> locker(this->mutex);
+		++this->failedTasks;
+		handler = this->exceptionHandler;
+	}
+
+	if (handler) {
+		handler(runnable, e);
+	}
 }
 
 std::size_t ThreadPoolPrivate::activeThreadCount() const
@@ -81,30 +211,353 @@ std::size_t ThreadPoolPrivate::activeThreadCount() const
 
 void ThreadPoolPrivate::tryToStartMoreThreads()
 {
-	while (!this->queue.empty() && this->tryStart(this->queue.front().first)) {
+	if (this->paused) {
+		return;
+	}
+
+	this->dropExpiredTasks();
+
+	// Queued tasks are picked up by the woken threads; only hand tasks over directly to new or restarted threads
+	auto pending = this->queue.size();
+	while (pending && !this->waitingThreads.empty() && this->canActivateThread()) {
+		this->wakeWaitingThread();
+		--pending;
+	}
+
+	while (pending) {
+		auto* r = this->queue.front();
+		bool started;
+		try {
+			started = this->tryStart(r);
+		}
+		catch (const std::system_error&) {
+			// The running threads get to the queue eventually; with none running the caller has to know
+			if (!this->activeThreads) {
+				throw;
+			}
+
+			started = false;
+		}
+
+		if (!started) {
+			break;
+		}
+
+		// The started thread took its own reference, the one held by the queue is no longer needed
 		this->queue.pop_front();
+		this->notifyQueueSpace();
+		r->deref();
+		--pending;
 	}
 }
 
+std::size_t ThreadPoolPrivate::budgetedThreadCount() const
+{
+	// A parked poller may wake up on its own to run an I/O callback, so it does not give its token back
+	return this->activeThreadCount() - this->reservedThreads + (this->pollerParked ? 1 : 0);
+}
+
 bool ThreadPoolPrivate::tooManyThreadsActive() const
 {
 	const auto activeThreadCount = this->activeThreadCount();
-	return activeThreadCount > this->maxThreadCount && (activeThreadCount - this->reservedThreads) > 1;
+	const auto overBudget        = this->budget && this->budgetedThreadCount() > std::min(this->budgetTokens, this->budgetMax);
+
+	return (activeThreadCount > this->maxThreadCount || overBudget) && (activeThreadCount - this->reservedThreads) > 1;
+}
+
+bool ThreadPoolPrivate::canActivateThread()
+{
+	if (this->activeThreadCount() >= this->maxThreadCount) {
+		return false;
+	}
+
+	if (!this->budget) {
+		return true;
+	}
+
+	const auto used = this->budgetedThreadCount();
+	if (used < this->budgetTokens) {
+		return true;
+	}
+
+	// The token is taken right away so that no other pool gets it first; the caller activates a thread next
+	if (used == this->budgetTokens && this->budgetTokens < this->budgetMax && (this->budgetTokens < this->budgetMin || this->budget->tryBorrow())) {
+		++this->budgetTokens;
+		return true;
+	}
+
+	// The parked poller brings its own token; the caller wakes up the first waiting thread
+	if (this->pollerParked) {
+		auto it = std::find(this->waitingThreads.begin(), this->waitingThreads.end(), this->poller);
+		std::rotate(this->waitingThreads.begin(), it, it + 1);
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPoolPrivate::syncBudget()
+{
+	// reset() empties allThreads before the threads are gone, the count only adds up again afterwards
+	if (!this->budget || this->isExiting) {
+		return;
+	}
+
+	const auto used = this->budgetedThreadCount();
+	while (this->budgetTokens > used) {
+		if (--this->budgetTokens >= this->budgetMin) {
+			this->budget->giveBack();
+		}
+	}
+
+	// Activations ask canActivateThread() first, and the first worker always gets a guaranteed token;
+	// only a pool attached while busy and a worker that is about to retire can run short here
+	while (this->budgetTokens < used && (this->budgetTokens < this->budgetMin || this->budget->tryBorrow())) {
+		++this->budgetTokens;
+	}
+}
+
+bool ThreadPoolPrivate::setBudget(WorkerBudget* budget, std::size_t minimum, std::size_t maximum)
+{
+	// Without a guaranteed token, nothing would wake this pool up once other pools give theirs back
+	if (budget && !minimum) {
+		return false;
+	}
+
+	// Everything is handed back on the old terms and then taken again on the new ones; what this pool borrowed can then be guaranteed to it
+	if (this->budget) {
+		while (this->budgetTokens) {
+			if (--this->budgetTokens >= this->budgetMin) {
+				this->budget->giveBack();
+			}
+		}
+	}
+
+	if (budget) {
+		const auto reserved = budget == this->budget ? this->budgetMin : 0;
+		if (minimum > reserved && !budget->reserve(minimum - reserved)) {
+			this->syncBudget();
+			return false;
+		}
+	}
+
+	if (this->budget) {
+		if (this->budget != budget) {
+			this->budget->unreserve(this->budgetMin);
+		}
+		else if (minimum < this->budgetMin) {
+			budget->unreserve(this->budgetMin - minimum);
+		}
+	}
+
+	this->budget    = budget;
+	this->budgetMin = budget ? minimum : 0;
+	this->budgetMax = budget ? std::max(minimum, maximum) : 0;
+	this->syncBudget();
+	return true;
+}
+
+void ThreadPoolPrivate::wakeWaitingThread()
+{
+	auto* t = this->waitingThreads.front();
+	this->waitingThreads.erase(this->waitingThreads.begin());
+	if (t == this->poller) {
+		this->pollerParked = false;
+		this->doorbell.ring();
+	}
+	else if (t->parker->notify()) {
+		if (this->deferWakeups && !this->deferredWake) {
+			this->deferredWake = t->parker;
+		}
+		else {
+			t->parker->wake();
+		}
+	}
+
+	this->syncBudget();
 }
 
 void ThreadPoolPrivate::startThread(Runnable* runnable)
 {
-	std::unique_ptr<ThreadPoolThread> thread(new ThreadPoolThread(this));
-	this->allThreads.insert(thread.get());
+	// Threads are only ever destroyed all at once by reset(), so this keeps indices dense
+	// Parkers outlive their threads: a deferred wake() may still be on its way after the thread is gone
+	if (this->idleParkers.empty()) {
+		this->parkers.emplace_back(new Parker());
+		this->idleParkers.push_back(this->parkers.back().get());
+	}
+
+	auto* parker = this->idleParkers.back();
+	this->idleParkers.pop_back();
+
+	auto* thread = this->threadSlots.create(this, this->allThreads.size(), parker);
+	try {
+		this->allThreads.insert(thread);
+	}
+	catch (...) {
+		this->threadSlots.destroy(thread);
+		this->idleParkers.push_back(parker);
+		throw;
+	}
+
 	++this->activeThreads;
+	this->syncBudget();
 
-	if (runnable->autoDelete()) {
-		++runnable->m_ref;
+	if (runnable) {
+		runnable->ref();
 	}
 
+	trace(TraceEvent::Spawn, runnable);
 	thread->runnable = runnable;
-	thread->thread   = std::thread(&ThreadPoolThread::operator(), thread.get());
-	thread.release();
+	try {
+		thread->launch(this->stackSize, this->stackFlags);
+	}
+	catch (...) {
+		this->allThreads.erase(thread);
+		this->threadSlots.destroy(thread);
+		this->idleParkers.push_back(parker);
+		this->launchFailed(runnable);
+		throw;
+	}
+}
+
+void ThreadPoolPrivate::launchFailed(Runnable* runnable)
+{
+	// Otherwise waitForDone() would wait for a thread that never ran; the task still belongs to the caller
+	if (--this->activeThreads == 0) {
+		this->noActiveThreads.notify_all();
+	}
+
+	this->syncBudget();
+	if (runnable) {
+		runnable->deref();
+	}
+}
+
+bool ThreadPoolPrivate::startIdleThread()
+{
+	const std::unique_lock<std::mutex> locker(this->mutex);
+	if (this->isExiting || this->paused || !this->canActivateThread()) {
+		return false;
+	}
+
+	if (!this->waitingThreads.empty()) {
+		this->wakeWaitingThread();
+		return true;
+	}
+
+	// A thread started without a task goes straight to the queue and then to the siblings
+	try {
+		return this->tryStart(nullptr);
+	}
+	catch (const std::system_error&) {
+		return false;
+	}
+}
+
+Runnable* ThreadPoolPrivate::stealTask()
+{
+	const auto n     = this->siblings.size();
+	const auto first = this->nextSibling.load(std::memory_order_relaxed);
+	for (std::size_t i = 0; i < n; ++i) {
+		auto* s = this->siblings[(first + i) % n];
+		const std::unique_lock<std::mutex> locker(s->mutex);
+		if (s->paused) {
+			continue;
+		}
+
+		s->dropExpiredTasks();
+		if (!s->queue.empty()) {
+			auto* r = s->queue.front();
+			s->queue.pop_front();
+			s->notifyQueueSpace();
+			trace(TraceEvent::Dequeue, r);
+
+			if (s->queue.empty() && !s->activeThreads) {
+				s->noActiveThreads.notify_all();
+			}
+
+			this->nextSibling.store((first + i) % n, std::memory_order_relaxed);
+			return r;
+		}
+	}
+
+	return nullptr;
+}
+
+std::size_t ThreadPoolPrivate::drainProducers()
+{
+	std::size_t n = 0;
+	WaitFreeProducer::Slot slot;
+	for (auto* p : this->producers) {
+		while (p->pop(slot)) {
+			trace(TraceEvent::Enqueue, slot.runnable);
+			this->enqueueTask(slot.runnable, slot.priority);
+			++n;
+		}
+	}
+
+	return n;
+}
+
+bool ThreadPoolPrivate::producersIdle() const noexcept
+{
+	for (auto* p : this->producers) {
+		if (!p->empty()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ThreadPoolPrivate::startPoller()
+{
+	// Producers cannot start threads themselves, so one idle worker has to be watching the doorbell
+	if (this->poller || this->isExiting) {
+		return;
+	}
+
+	// Out of tokens, the pool has a worker running, and that one takes the role over when it parks
+	if (this->budget && !this->allThreads.empty() && !this->canActivateThread()) {
+		return;
+	}
+
+	if (!this->waitingThreads.empty()) {
+		this->wakeWaitingThread();
+	}
+	else if (this->allThreads.empty() || this->canActivateThread()) {
+		this->tryStart(nullptr);
+	}
+}
+
+void ThreadPoolPrivate::runIoCallback(std::unique_lock<std::mutex>& locker, std::uint64_t token, unsigned int events)
+{
+	auto reg = this->reactor.find(token);
+	if (!reg) {
+		return;
+	}
+
+	// Leader/followers: this worker runs the callback itself and hands the epoll set over to another idle worker
+	reg->runner = ThreadPoolThread::current();
+	this->startPoller();
+	locker.unlock();
+
+	trace(TraceEvent::Start, reg.get());
+	try {
+		reg->callback(reg->fd, events);
+	}
+	catch (...) {
+		this->taskFailed(nullptr, std::current_exception());
+	}
+
+	trace(TraceEvent::End, reg.get());
+
+	locker.lock();
+	reg->runner = nullptr;
+	this->ioDone.notify_all();
+	if (this->reactor.find(token)) {
+		this->reactor.rearm(*reg);
+	}
 }
 
 void ThreadPoolPrivate::reset()
@@ -118,49 +571,71 @@ void ThreadPoolPrivate::reset()
 		locker.unlock();
 
 		for (auto it : allThreadsCopy) {
-			it->runnableReady.notify_all();
-			it->thread.join();
-			delete it;
+			this->doorbell.ring();
+			it->parker->unpark();
+			it->join();
 		}
 
+		// Slots are handed out under the lock, and start() may already be adding threads again
 		locker.lock();
+		for (auto it : allThreadsCopy) {
+			this->idleParkers.push_back(it->parker);
+			this->threadSlots.destroy(it);
+		}
 	}
 
 	this->waitingThreads.clear();
 	this->expiredThreads.clear();
 	isExiting = false;
+	this->syncBudget();
+
+	if (this->needsPoller()) {
+		this->startPoller();
+	}
 }
 
-bool ThreadPoolPrivate::waitForDone(unsigned long int msecs)
+template<typename Predicate>
+bool ThreadPoolPrivate::waitFor(unsigned long int msecs, Predicate done)
 {
 	std::unique_lock<std::mutex> locker(this->mutex);
 	if (msecs == std::numeric_limits<unsigned long int>::max()) {
-		this->noActiveThreads.wait(locker, [this] {
-			return this->queue.empty() && this->activeThreads == 0;
-		});
+		this->noActiveThreads.wait(locker, done);
 	}
 	else {
-		const auto duration = std::chrono::milliseconds(msecs);
-
-		this->noActiveThreads.wait_for(locker, duration, [this] {
-			return this->queue.empty() && this->activeThreads == 0;
-		});
+		this->noActiveThreads.wait_for(locker, std::chrono::milliseconds(msecs), done);
 	}
 
-	return this->queue.empty() && !this->activeThreads;
+	return done();
+}
+
+bool ThreadPoolPrivate::waitForDone(unsigned long int msecs)
+{
+	return this->waitFor(msecs, [this] {
+		return this->queue.empty() && this->activeThreads == 0 && this->producersIdle();
+	});
+}
+
+bool ThreadPoolPrivate::drain(unsigned long int msecs)
+{
+	return this->waitFor(msecs, [this] {
+		return this->activeThreads == 0 && (this->paused || (this->queue.empty() && this->producersIdle()));
+	});
 }
 
 void ThreadPoolPrivate::clear()
 {
 	std::unique_lock<std::mutex> locker(this->mutex);
-	while (!this->queue.empty()) {
-		auto& item = this->queue.front();
-		auto* r = item.first;
-		if (r->autoDelete() && --r->m_ref) {
-			delete r;
-		}
+	this->queue.clear([this](Runnable* r) {
+		this->discardTask(r);
+	});
 
-		this->queue.pop_front();
+	this->notifyQueueSpace();
+
+	for (auto* t : this->allThreads) {
+		if (t->runNext) {
+			this->discardTask(t->runNext);
+			t->runNext = nullptr;
+		}
 	}
 }
 
@@ -171,16 +646,16 @@ bool ThreadPoolPrivate::stealRunnable(const Runnable* runnable)
 	}
 
 	std::unique_lock<std::mutex> locker(this->mutex);
-	auto it  = this->queue.begin();
-	auto end = this->queue.end();
+	if (this->queue.remove(runnable)) {
+		this->notifyQueueSpace();
+		return true;
+	}
 
-	while (it != end) {
-		if (it->first == runnable) {
-			this->queue.erase(it);
+	for (auto* t : this->allThreads) {
+		if (t->runNext == runnable) {
+			t->runNext = nullptr;
 			return true;
 		}
-
-		++it;
 	}
 
 	return false;
@@ -189,10 +664,18 @@ bool ThreadPoolPrivate::stealRunnable(const Runnable* runnable)
 void ThreadPoolPrivate::stealAndRunRunnable(Runnable* runnable)
 {
 	if (this->stealRunnable(runnable)) {
-		const auto autoDelete = runnable->autoDelete();
-		bool del = autoDelete && !--runnable->m_ref;
+		const auto del = runnable->deref();
 
-		runnable->run();
+		try {
+			runnable->run();
+		}
+		catch (...) {
+			if (del) {
+				delete runnable;
+			}
+
+			throw;
+		}
 
 		if (del) {
 			delete runnable;
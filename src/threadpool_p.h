@@ -1,46 +1,126 @@
 #ifndef THREADPOOL_P_H
 #define THREADPOOL_P_H
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <utility>
+#include <vector>
+#include "cacheline.h"
+#include "doorbell.h"
+#include "parker.h"
+#include "reactor.h"
+#include "slotarray.h"
+#include "taskqueue.h"
 
 class Runnable;
 class ThreadPoolThread;
+class WaitFreeProducer;
+class WorkerBudget;
 
-class ThreadPoolPrivate {
+class ThreadPoolPrivate : public CacheAligned {
 public:
 	ThreadPoolPrivate();
 
-	bool tryStart(Runnable* runnable);
-	void enqueueTask(Runnable* runnable, int priority = 0);
+	using clock = TaskQueue::clock;
+
+	// The returned parker (if any) belongs to a sleeping worker: wake() it once the lock is released
+	Parker* submit(Runnable* runnable, int priority, clock::time_point deadline, std::size_t bytes = 0);
+	bool tryStart(Runnable* runnable, int priority = 0, clock::time_point deadline = clock::time_point::max(), std::size_t bytes = 0);
+	void enqueueTask(Runnable* runnable, int priority = 0, clock::time_point deadline = clock::time_point::max(), std::size_t bytes = 0);
+	bool waitForQueueSpace(std::unique_lock<std::mutex>& locker, std::size_t bytes, unsigned long int msecs);
+	void notifyQueueSpace();
+	void setRunNext(ThreadPoolThread* thread, Runnable* runnable, int priority);
+	void dropExpiredTasks();
+	void discardTask(Runnable* runnable);
+	void taskFailed(Runnable* runnable, std::exception_ptr e);
 
 	std::size_t activeThreadCount() const;
+	std::size_t budgetedThreadCount() const;
 
 	void tryToStartMoreThreads();
 	bool tooManyThreadsActive() const;
+	bool canActivateThread();
+	void syncBudget();
+	bool setBudget(WorkerBudget* budget, std::size_t minimum, std::size_t maximum);
 
+	void wakeWaitingThread();
 	void startThread(Runnable* runnable = nullptr);
+	void launchFailed(Runnable* runnable);
+	bool startIdleThread();
+	Runnable* stealTask();
+	std::size_t drainProducers();
+	bool producersIdle() const noexcept;
+	void startPoller();
+	bool needsPoller() const noexcept { return !this->producers.empty() || !this->reactor.empty(); }
+	void runIoCallback(std::unique_lock<std::mutex>& locker, std::uint64_t token, unsigned int events);
 	void reset();
 	bool waitForDone(unsigned long int msecs);
+	bool drain(unsigned long int msecs);
 	void clear();
 	bool stealRunnable(const Runnable* runnable);
 	void stealAndRunRunnable(Runnable* runnable);
 
-	mutable std::mutex mutex;
-	std::set<ThreadPoolThread*> allThreads;
-	std::list<ThreadPoolThread*> waitingThreads;
-	std::list<ThreadPoolThread*> expiredThreads;
-	std::list<std::pair<Runnable*, int> > queue;
-	std::condition_variable noActiveThreads;
-
+	// Read-mostly: written by the setters, read by every worker
+	std::vector<ThreadPoolPrivate*> siblings;
+	std::function<void(Runnable*, std::exception_ptr)> exceptionHandler;
+	std::function<void(std::size_t)> threadStartHook;
+	std::function<void(std::size_t)> threadExitHook;
 	bool isExiting = false;
+	bool dropExpired = false;
+	bool inlineDispatch = false;
+	bool paused = false;
 	unsigned long int expiryTimeout = 30000;
 	std::size_t maxThreadCount;
-	std::size_t reservedThreads = 0;
+	std::size_t maxQueuedBytes = std::numeric_limits<std::size_t>::max();
+	std::size_t stackSize = 0;
+	unsigned int stackFlags = 0;
+	WorkerBudget* budget = nullptr;
+	std::size_t budgetMin = 0;
+	std::size_t budgetMax = 0;
+
+	// Written on every submission and every task switch, always under the lock
+	alignas(cache_line_size) mutable std::mutex mutex;
+	TaskQueue queue;
 	std::size_t activeThreads = 0;
+	std::size_t reservedThreads = 0;
+	std::size_t expiredTasks = 0;
+	std::size_t failedTasks = 0;
+	std::size_t budgetTokens = 0;
+	std::size_t queueSpaceWaiters = 0;
+	ThreadPoolThread* poller = nullptr;
+	bool pollerParked = false;
+	std::set<ThreadPoolThread*> allThreads;
+	SlotArray<ThreadPoolThread> threadSlots;
+	std::vector<ThreadPoolThread*> waitingThreads;
+	std::list<ThreadPoolThread*> expiredThreads;
+	std::vector<WaitFreeProducer*> producers;
+	std::vector<std::unique_ptr<Parker> > parkers;
+	std::vector<Parker*> idleParkers;
+	Parker* deferredWake = nullptr;
+	bool deferWakeups = false;
+	std::condition_variable noActiveThreads;
+	std::condition_variable ioDone;
+	std::condition_variable queueSpace;
+
+	// Used without the lock: rung by producers and signal handlers, waited on by the poller
+	alignas(cache_line_size) Doorbell doorbell;
+	Reactor reactor{&doorbell};
+
+	// Written by this pool's workers while they steal from the siblings
+	alignas(cache_line_size) std::atomic<std::size_t> nextSibling{0};
+
+private:
+	template<typename Predicate>
+	bool waitFor(unsigned long int msecs, Predicate done);
 };
 
 #endif // THREADPOOL_P_H
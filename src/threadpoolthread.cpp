@@ -1,17 +1,212 @@
 #include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <exception>
 #include <mutex>
+#include <system_error>
 #include "threadpoolthread.h"
+#include "parker.h"
+#include "threadpool.h"
 #include "threadpool_p.h"
 #include "runnable.h"
+#include "tracer.h"
 
-ThreadPoolThread::ThreadPoolThread(ThreadPoolPrivate* manager)
-	: manager(manager)
+#if defined(__unix__) || defined(__APPLE__)
+#include <climits>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+thread_local ThreadPoolThread* t_current = nullptr;
+
+// Consecutive tasks a worker may take from its inline dispatch slot while others wait in the queue
+const unsigned int max_run_next_streak = 16;
+
+}
+
+ThreadPoolThread::ThreadPoolThread(ThreadPoolPrivate* manager, std::size_t index, Parker* parker)
+	: manager(manager), parker(parker), index(index)
 {
 }
 
+ThreadPoolThread::~ThreadPoolThread()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	this->freeStack();
+#endif
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+void ThreadPoolThread::launch(std::size_t stackSize, unsigned int stackFlags)
+{
+	if (!stackSize && !stackFlags) {
+		this->thread = std::thread(&ThreadPoolThread::operator(), this);
+		return;
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+
+	if (!stackSize) {
+		pthread_attr_getstacksize(&attr, &stackSize);
+	}
+
+	stackSize = std::max<std::size_t>(stackSize, PTHREAD_STACK_MIN);
+
+	int res;
+	if (stackFlags) {
+		// The stack survives thread expiry: a restarted thread reuses the already faulted-in memory
+		if (!this->stack || this->stackSize != stackSize || this->stackFlags != stackFlags) {
+			this->freeStack();
+			this->allocateStack(stackSize, stackFlags);
+		}
+
+		res = this->stack ? pthread_attr_setstack(&attr, this->stack, this->stackBytes) : pthread_attr_setstacksize(&attr, stackSize);
+	}
+	else {
+		res = pthread_attr_setstacksize(&attr, stackSize);
+	}
+
+	if (!res) {
+		res = pthread_create(&this->handle, &attr, &ThreadPoolThread::entry, this);
+	}
+
+	pthread_attr_destroy(&attr);
+	if (res) {
+		throw std::system_error(res, std::generic_category(), "pthread_create");
+	}
+
+	this->native = true;
+}
+
+void ThreadPoolThread::join()
+{
+	if (this->native) {
+		pthread_join(this->handle, nullptr);
+		this->native = false;
+	}
+	else if (this->thread.joinable()) {
+		this->thread.join();
+	}
+}
+
+void* ThreadPoolThread::entry(void* self)
+{
+	(*static_cast<ThreadPoolThread*>(self))();
+	return nullptr;
+}
+
+void ThreadPoolThread::allocateStack(std::size_t size, unsigned int flags)
+{
+	const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	void* p         = MAP_FAILED;
+	std::size_t len = 0;
+	bool guard      = true;
+
+#ifdef MAP_HUGETLB
+	if (flags & ThreadPool::StackHugePages) {
+		const std::size_t huge = 2 * 1024 * 1024;
+		len   = (size + huge - 1) / huge * huge;
+		p     = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_HUGETLB, -1, 0);
+		guard = false;
+	}
+#endif
+
+	if (p == MAP_FAILED) {
+		// Falls back to normal pages (with a guard page) when no hugetlbfs pages are reserved
+		len   = (size + page - 1) / page * page + page;
+		guard = true;
+		p     = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			return;
+		}
+
+		mprotect(p, page, PROT_NONE);
+#ifdef MADV_HUGEPAGE
+		if (flags & ThreadPool::StackHugePages) {
+			madvise(p, len, MADV_HUGEPAGE);
+		}
+#endif
+	}
+
+	this->mapping      = p;
+	this->mappingBytes = len;
+	this->stack        = guard ? static_cast<char*>(p) + page : p;
+	this->stackBytes   = guard ? len - page : len;
+	this->stackSize    = size;
+	this->stackFlags   = flags;
+
+	// launch() runs under the pool lock, so the pages are faulted in by the new thread itself
+	this->prefaultPending = (flags & ThreadPool::StackPrefault) != 0;
+}
+
+void ThreadPoolThread::prefaultStack()
+{
+	if (!this->prefaultPending) {
+		return;
+	}
+
+	this->prefaultPending = false;
+	auto* base = static_cast<char*>(this->stack);
+
+#ifdef MADV_POPULATE_WRITE
+	if (!madvise(base, this->stackBytes, MADV_POPULATE_WRITE)) {
+		return;
+	}
+#endif
+
+	// The stack grows down, so everything more than a page below this frame is still unused
+	const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	volatile char marker = 0;
+	const auto* top = const_cast<const char*>(&marker) - page;
+	for (auto* p = base; p < top; p += page) {
+		*static_cast<volatile char*>(p) = 0;
+	}
+}
+
+void ThreadPoolThread::freeStack()
+{
+	if (this->mapping) {
+		munmap(this->mapping, this->mappingBytes);
+		this->mapping = this->stack = nullptr;
+	}
+}
+
+#else
+
+void ThreadPoolThread::launch(std::size_t, unsigned int)
+{
+	this->thread = std::thread(&ThreadPoolThread::operator(), this);
+}
+
+void ThreadPoolThread::join()
+{
+	if (this->thread.joinable()) {
+		this->thread.join();
+	}
+}
+
+#endif
+
 void ThreadPoolThread::operator()(void)
 {
+	t_current = this;
+
+#if defined(__unix__) || defined(__APPLE__)
+	this->prefaultStack();
+#endif
+
 	std::unique_lock<std::mutex> locker(this->manager->mutex);
+	auto on_start = this->manager->threadStartHook;
+	if (on_start) {
+		locker.unlock();
+		on_start(this->index);
+		locker.lock();
+	}
+
 	while (true) {
 		auto* r        = this->runnable;
 		this->runnable = nullptr;
@@ -21,24 +216,64 @@ void ThreadPoolThread::operator()(void)
 				const auto auto_delete = r->autoDelete();
 
 				locker.unlock();
-				r->run();
-				locker.lock();
+				trace(TraceEvent::Start, r);
+				try {
+					r->run();
+				}
+				catch (...) {
+					this->manager->taskFailed(r, std::current_exception());
+				}
+
+				trace(TraceEvent::End, r);
 
-				if (auto_delete && !--r->m_ref) {
+				// Reference counting is atomic, so the pool lock is not needed to release (and destroy) the task
+				if (auto_delete && r->deref()) {
 					delete r;
 				}
+
+				locker.lock();
 			}
 
-			if (this->manager->tooManyThreadsActive()) {
+			if (this->manager->tooManyThreadsActive() || this->manager->paused) {
+				this->requeueRunNext();
 				break;
 			}
 
+			if (!this->manager->producers.empty() && this->manager->drainProducers()) {
+				this->manager->tryToStartMoreThreads();
+			}
+
+			this->manager->dropExpiredTasks();
+			if (this->runNext && (this->runNextStreak < max_run_next_streak || this->manager->queue.empty())) {
+				r             = this->runNext;
+				this->runNext = nullptr;
+				++this->runNextStreak;
+				trace(TraceEvent::Dequeue, r);
+				continue;
+			}
+
+			// Tasks that keep handing work to themselves must not starve the queue
+			this->runNextStreak = 0;
+			this->requeueRunNext();
+
 			if (this->manager->queue.empty()) {
 				r = nullptr;
+				if (!this->manager->siblings.empty() && !this->manager->isExiting) {
+					locker.unlock();
+					r = this->manager->stealTask();
+					locker.lock();
+				}
 			}
 			else {
-				r = this->manager->queue.front().first;
+				r = this->manager->queue.front();
 				this->manager->queue.pop_front();
+				this->manager->notifyQueueSpace();
+				trace(TraceEvent::Dequeue, r);
+
+				// Tokens given back by other pools are only picked up here; the guaranteed ones keep the queue moving until then
+				if (this->manager->budget && !this->manager->queue.empty()) {
+					this->manager->tryToStartMoreThreads();
+				}
 			}
 		} while (r);
 
@@ -49,28 +284,105 @@ void ThreadPoolThread::operator()(void)
 
 		bool expired = this->manager->tooManyThreadsActive();
 		if (!expired) {
+			// Nobody can notify a thread that is not on the waiting list, so anything left over is stale
+			this->parker->reset();
 			this->manager->waitingThreads.push_back(this);
+
+			// One idle worker watches the doorbell (and the epoll set) instead of its condition variable;
+			// it is marked before registerThreadInactive() so that it keeps its budget token
+			const auto polling = this->manager->needsPoller() && !this->manager->poller;
+			if (polling) {
+				this->manager->poller       = this;
+				this->manager->pollerParked = true;
+			}
+
 			this->registerThreadInactive();
-			this->runnableReady.wait_for(locker, std::chrono::milliseconds(manager->expiryTimeout));
+			trace(TraceEvent::Park);
+
+			std::uint64_t io_token = 0;
+			unsigned int io_events = 0;
+			if (polling) {
+				this->manager->doorbell.arm();
+
+				// Nothing is taken from the rings while paused, so a non-empty one is no reason to keep spinning
+				if (this->manager->paused || this->manager->producersIdle()) {
+					const auto io = !this->manager->reactor.empty() && !this->manager->paused;
+					locker.unlock();
+					if (io) {
+						this->manager->reactor.wait(manager->expiryTimeout, &io_token, &io_events);
+					}
+					else {
+						this->manager->doorbell.wait(manager->expiryTimeout);
+					}
+
+					locker.lock();
+				}
+				else {
+					this->manager->doorbell.disarm();
+				}
+
+				this->manager->poller       = nullptr;
+				this->manager->pollerParked = false;
+			}
+			else {
+				const auto timeout = this->manager->expiryTimeout;
+				locker.unlock();
+				this->parker->park(timeout);
+				locker.lock();
+			}
+
+			trace(TraceEvent::Wake);
 			++manager->activeThreads;
 
 			auto it = std::find(this->manager->waitingThreads.begin(), this->manager->waitingThreads.end(), this);
 			if (it != this->manager->waitingThreads.end()) {
 				this->manager->waitingThreads.erase(it);
-				expired = true;
+				// The poller is not expired by a timeout as long as there is something to watch
+				expired = !polling || !this->manager->needsPoller();
+			}
+
+			if (!expired) {
+				this->manager->syncBudget();
+			}
+
+			if (io_token) {
+				this->manager->runIoCallback(locker, io_token, io_events);
 			}
 		}
 
 		if (expired) {
+			trace(TraceEvent::Expire);
 			this->manager->expiredThreads.push_back(this);
 			this->registerThreadInactive();
 			break;
 		}
 	}
+
+	auto on_exit = this->manager->threadExitHook;
+	locker.unlock();
+	if (on_exit) {
+		on_exit(this->index);
+	}
+
+	t_current = nullptr;
+}
+
+ThreadPoolThread* ThreadPoolThread::current() noexcept
+{
+	return t_current;
+}
+
+void ThreadPoolThread::requeueRunNext()
+{
+	if (this->runNext) {
+		this->manager->queue.push(this->runNext, this->runNextPriority);
+		this->runNext = nullptr;
+	}
 }
 
 void ThreadPoolThread::registerThreadInactive()
 {
+	this->manager->syncBudget();
 	if (--this->manager->activeThreads == 0) {
 		this->manager->noActiveThreads.notify_all();
 	}
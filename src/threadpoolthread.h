@@ -1,24 +1,62 @@
 #ifndef THREADPOOLTHREAD_H
 #define THREADPOOLTHREAD_H
 
-#include <condition_variable>
+#include <cstddef>
 #include <thread>
+#include "cacheline.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+class Parker;
 class Runnable;
 class ThreadPoolPrivate;
 
 class ThreadPoolThread {
 public:
-	explicit ThreadPoolThread(ThreadPoolPrivate* manager);
+	ThreadPoolThread(ThreadPoolPrivate* manager, std::size_t index, Parker* parker);
+	~ThreadPoolThread();
 
 	void operator()();
 
+	void launch(std::size_t stackSize, unsigned int stackFlags);
+	void join();
+
 	void registerThreadInactive();
+	void requeueRunNext();
+
+	static ThreadPoolThread* current() noexcept;
 
-	std::condition_variable runnableReady;
-	ThreadPoolPrivate* manager;
-	Runnable* runnable = nullptr;
+	// Set by the thread waking this one up
+	alignas(cache_line_size) Runnable* runnable = nullptr;
+	Runnable* runNext = nullptr;
+	int runNextPriority = 0;
+
+	// Only touched by the worker itself (and by whoever joins it)
+	alignas(cache_line_size) ThreadPoolPrivate* manager;
+	Parker* parker;
+	std::size_t index;
+	unsigned int runNextStreak = 0;
 	std::thread thread;
+
+#if defined(__unix__) || defined(__APPLE__)
+private:
+	static void* entry(void* self);
+	void allocateStack(std::size_t size, unsigned int flags);
+	void freeStack();
+	void prefaultStack();
+
+	pthread_t handle;
+	bool native = false;
+	void* mapping = nullptr;
+	std::size_t mappingBytes = 0;
+	void* stack = nullptr;
+	std::size_t stackBytes = 0;
+	std::size_t stackSize = 0;
+	unsigned int stackFlags = 0;
+	bool prefaultPending = false;
+#endif
 };
 
 #endif // THREADPOOLTHREAD_H
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "tracer.h"
+
+namespace {
+
+struct Slot {
+	std::atomic<std::uint64_t> seq{0};
+	std::atomic<std::uint64_t> ts{0};
+	std::atomic<const void*> task{nullptr};
+	std::atomic<std::uint32_t> tid{0};
+	std::atomic<std::uint8_t> event{0};
+};
+
+struct Ring {
+	explicit Ring(std::size_t capacity)
+		: slots(new Slot[capacity]), capacity(capacity)
+	{
+	}
+
+	std::unique_ptr<Slot[]> slots;
+	std::size_t capacity;
+	std::atomic<std::uint64_t> head{0};
+	// Events before this index were dropped by Tracer::clear(); guarded by the registry mutex
+	std::uint64_t cleared = 0;
+	std::uint32_t tid = 0;
+	bool inUse = false;
+};
+
+struct Registry {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<Ring> > rings;
+	std::size_t capacity = 8192;
+	std::uint32_t nextTid = 0;
+};
+
+Registry& registry()
+{
+	static Registry* r = new Registry();
+	return *r;
+}
+
+Ring* acquireRing()
+{
+	auto& reg = registry();
+	const std::lock_guard<std::mutex> locker(reg.mutex);
+
+	for (auto& ring : reg.rings) {
+		if (!ring->inUse && ring->capacity == reg.capacity) {
+			ring->inUse = true;
+			ring->tid   = ++reg.nextTid;
+			return ring.get();
+		}
+	}
+
+	reg.rings.emplace_back(new Ring(reg.capacity));
+	auto* ring  = reg.rings.back().get();
+	ring->inUse = true;
+	ring->tid   = ++reg.nextTid;
+	return ring;
+}
+
+// Hands the ring back for reuse by another thread once this one exits; the recorded events are kept
+struct RingHolder {
+	~RingHolder()
+	{
+		if (this->ring) {
+			auto& reg = registry();
+			const std::lock_guard<std::mutex> locker(reg.mutex);
+			this->ring->inUse = false;
+		}
+	}
+
+	Ring* ring = nullptr;
+};
+
+thread_local RingHolder t_ring;
+
+std::uint64_t now() noexcept
+{
+	return static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+	);
+}
+
+struct Record {
+	std::uint64_t ts;
+	const void* task;
+	std::uint32_t tid;
+	TraceEvent event;
+};
+
+const char* eventName(TraceEvent event)
+{
+	switch (event) {
+		case TraceEvent::Enqueue: return "enqueue";
+		case TraceEvent::Dequeue: return "dequeue";
+		case TraceEvent::Start:   return "run";
+		case TraceEvent::End:     return "run";
+		case TraceEvent::Park:    return "park";
+		case TraceEvent::Wake:    return "wake";
+		case TraceEvent::Spawn:   return "spawn";
+		case TraceEvent::Expire:  return "expire";
+	}
+
+	return "unknown";
+}
+
+const char* eventPhase(TraceEvent event)
+{
+	switch (event) {
+		case TraceEvent::Start: return "B";
+		case TraceEvent::End:   return "E";
+		default:                return "i";
+	}
+}
+
+}
+
+std::atomic<bool> Tracer::s_enabled(false);
+
+void Tracer::enable(std::size_t eventsPerThread)
+{
+	auto& reg = registry();
+	{
+		const std::lock_guard<std::mutex> locker(reg.mutex);
+		reg.capacity = std::max<std::size_t>(eventsPerThread, 1);
+	}
+
+	Tracer::s_enabled.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::disable() noexcept
+{
+	Tracer::s_enabled.store(false, std::memory_order_relaxed);
+}
+
+void Tracer::record(TraceEvent event, const void* task) noexcept
+{
+	auto* ring = t_ring.ring;
+	if (!ring) {
+		try {
+			ring = t_ring.ring = acquireRing();
+		}
+		catch (...) {
+			return;
+		}
+	}
+
+	const auto idx = ring->head.load(std::memory_order_relaxed);
+	auto& slot     = ring->slots[idx % ring->capacity];
+
+	// Seqlock-style publication: a reader that sees seq == idx + 1 before and after copying got a consistent event
+	slot.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.ts.store(now(), std::memory_order_relaxed);
+	slot.task.store(task, std::memory_order_relaxed);
+	slot.tid.store(ring->tid, std::memory_order_relaxed);
+	slot.event.store(static_cast<std::uint8_t>(event), std::memory_order_relaxed);
+	slot.seq.store(idx + 1, std::memory_order_release);
+	ring->head.store(idx + 1, std::memory_order_release);
+}
+
+void Tracer::dump(std::ostream& os)
+{
+	std::vector<Record> records;
+	std::vector<std::uint32_t> tids;
+
+	{
+		auto& reg = registry();
+		const std::lock_guard<std::mutex> locker(reg.mutex);
+		for (auto& ring : reg.rings) {
+			const auto head  = ring->head.load(std::memory_order_acquire);
+			const auto first = std::max(head > ring->capacity ? head - ring->capacity : 0, ring->cleared);
+			for (auto idx = first; idx < head; ++idx) {
+				auto& slot     = ring->slots[idx % ring->capacity];
+				const auto seq = slot.seq.load(std::memory_order_acquire);
+
+				Record rec;
+				rec.ts    = slot.ts.load(std::memory_order_relaxed);
+				rec.task  = slot.task.load(std::memory_order_relaxed);
+				rec.tid   = slot.tid.load(std::memory_order_relaxed);
+				rec.event = static_cast<TraceEvent>(slot.event.load(std::memory_order_relaxed));
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (seq == idx + 1 && slot.seq.load(std::memory_order_relaxed) == seq) {
+					records.push_back(rec);
+					tids.push_back(rec.tid);
+				}
+			}
+		}
+	}
+
+	std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+		return a.ts < b.ts;
+	});
+
+	std::sort(tids.begin(), tids.end());
+	tids.erase(std::unique(tids.begin(), tids.end()), tids.end());
+
+	const auto base = records.empty() ? 0 : records.front().ts;
+	bool first      = true;
+
+	os << "{\"traceEvents\":[";
+	for (auto tid : tids) {
+		os << (first ? "" : ",") << "\n"
+		   << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+		   << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+		first = false;
+	}
+
+	for (auto& rec : records) {
+		const auto ts = rec.ts - base;
+		os << (first ? "" : ",") << "\n"
+		   << "{\"name\":\"" << eventName(rec.event) << "\",\"ph\":\"" << eventPhase(rec.event)
+		   << "\",\"pid\":1,\"tid\":" << rec.tid
+		   << ",\"ts\":" << ts / 1000 << "." << (ts % 1000) / 100 << (ts % 100) / 10 << ts % 10;
+
+		if (rec.event != TraceEvent::Start && rec.event != TraceEvent::End) {
+			os << ",\"s\":\"t\"";
+		}
+
+		os << ",\"args\":{\"task\":\"" << rec.task << "\"}}";
+		first = false;
+	}
+
+	os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void Tracer::clear()
+{
+	auto& reg = registry();
+	const std::lock_guard<std::mutex> locker(reg.mutex);
+	// Only the readers' starting point moves: rewriting the rings would race with threads still recording into them
+	for (auto& ring : reg.rings) {
+		ring->cleared = ring->head.load(std::memory_order_acquire);
+	}
+}
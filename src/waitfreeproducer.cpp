@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <mutex>
+#include "waitfreeproducer.h"
+#include "threadpool.h"
+#include "threadpool_p.h"
+
+WaitFreeProducer::WaitFreeProducer(ThreadPool* pool, std::size_t capacity)
+	: d(pool->d_func())
+{
+	std::size_t n = 2;
+	while (n < capacity) {
+		n <<= 1;
+	}
+
+	this->m_slots.reset(new Slot[n]);
+	this->m_mask = n - 1;
+
+	const std::unique_lock<std::mutex> locker(this->d->mutex);
+	this->d->producers.push_back(this);
+	this->d->startPoller();
+}
+
+WaitFreeProducer::~WaitFreeProducer()
+{
+	const std::unique_lock<std::mutex> locker(this->d->mutex);
+	this->d->drainProducers();
+
+	auto& producers = this->d->producers;
+	producers.erase(std::find(producers.begin(), producers.end(), this));
+	this->d->tryToStartMoreThreads();
+}
+
+bool WaitFreeProducer::push(Runnable* runnable, int priority) noexcept
+{
+	const auto tail = this->m_tail.load(std::memory_order_relaxed);
+	if (tail - this->m_head.load(std::memory_order_acquire) > this->m_mask) {
+		return false;
+	}
+
+	auto& slot    = this->m_slots[tail & this->m_mask];
+	slot.runnable = runnable;
+	slot.priority = priority;
+	this->m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+bool WaitFreeProducer::pop(Slot& slot) noexcept
+{
+	const auto head = this->m_head.load(std::memory_order_relaxed);
+	if (head == this->m_tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	slot = this->m_slots[head & this->m_mask];
+	this->m_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool WaitFreeProducer::empty() const noexcept
+{
+	return this->m_head.load(std::memory_order_relaxed) == this->m_tail.load(std::memory_order_acquire);
+}
@@ -0,0 +1,53 @@
+#ifndef WAITFREEPRODUCER_H
+#define WAITFREEPRODUCER_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include "cacheline.h"
+
+class Runnable;
+class ThreadPool;
+class ThreadPoolPrivate;
+
+/*
+ * Single-producer submission ring for threads that must not block or
+ * allocate (real-time threads, signal handlers). Construct one per
+ * producing thread from a normal context; ThreadPool::trySubmitWaitFree()
+ * then only touches this ring and the pool's doorbell.
+ *
+ * Tasks are moved to the pool's queue by the workers. The producer must
+ * be destroyed before the pool; the destructor hands any tasks still in
+ * the ring over to the pool.
+ */
+class WaitFreeProducer : public CacheAligned {
+public:
+	explicit WaitFreeProducer(ThreadPool* pool, std::size_t capacity = 1024);
+	~WaitFreeProducer();
+
+	WaitFreeProducer(const WaitFreeProducer&) = delete;
+	WaitFreeProducer& operator=(const WaitFreeProducer&) = delete;
+
+	std::size_t capacity() const noexcept { return this->m_mask + 1; }
+
+private:
+	friend class ThreadPool;
+	friend class ThreadPoolPrivate;
+
+	struct Slot {
+		Runnable* runnable;
+		int priority;
+	};
+
+	bool push(Runnable* runnable, int priority) noexcept;
+	bool pop(Slot& slot) noexcept;
+	bool empty() const noexcept;
+
+	ThreadPoolPrivate* d;
+	std::unique_ptr<Slot[]> m_slots;
+	std::size_t m_mask;
+	alignas(cache_line_size) std::atomic<std::size_t> m_head{0};
+	alignas(cache_line_size) std::atomic<std::size_t> m_tail{0};
+};
+
+#endif // WAITFREEPRODUCER_H
@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <thread>
+#include "workerbudget.h"
+
+namespace {
+
+const std::uint64_t borrowed_mask = 0xFFFFFFFFu;
+
+inline std::size_t guaranteed_part(std::uint64_t state)
+{
+	return static_cast<std::size_t>(state >> 32);
+}
+
+inline std::size_t borrowed_part(std::uint64_t state)
+{
+	return static_cast<std::size_t>(state & borrowed_mask);
+}
+
+}
+
+WorkerBudget::WorkerBudget(std::size_t tokens)
+	: m_tokens(std::min<std::size_t>(tokens ? tokens : std::max(std::thread::hardware_concurrency(), 1u), borrowed_mask))
+{
+}
+
+std::size_t WorkerBudget::guaranteed() const noexcept
+{
+	return guaranteed_part(this->m_state.load(std::memory_order_relaxed));
+}
+
+std::size_t WorkerBudget::borrowed() const noexcept
+{
+	return borrowed_part(this->m_state.load(std::memory_order_relaxed));
+}
+
+std::size_t WorkerBudget::available() const noexcept
+{
+	const auto state = this->m_state.load(std::memory_order_relaxed);
+	const auto used  = guaranteed_part(state) + borrowed_part(state);
+	return used < this->m_tokens ? this->m_tokens - used : 0;
+}
+
+bool WorkerBudget::reserve(std::size_t minimum) noexcept
+{
+	auto state = this->m_state.load(std::memory_order_relaxed);
+	do {
+		// Tokens lent out are not there to be guaranteed until they come back
+		if (guaranteed_part(state) + borrowed_part(state) + minimum > this->m_tokens) {
+			return false;
+		}
+	} while (!this->m_state.compare_exchange_weak(state, state + (static_cast<std::uint64_t>(minimum) << 32), std::memory_order_acq_rel));
+
+	return true;
+}
+
+void WorkerBudget::unreserve(std::size_t minimum) noexcept
+{
+	this->m_state.fetch_sub(static_cast<std::uint64_t>(minimum) << 32, std::memory_order_acq_rel);
+}
+
+bool WorkerBudget::tryBorrow() noexcept
+{
+	auto state = this->m_state.load(std::memory_order_relaxed);
+	do {
+		if (guaranteed_part(state) + borrowed_part(state) >= this->m_tokens) {
+			return false;
+		}
+	} while (!this->m_state.compare_exchange_weak(state, state + 1, std::memory_order_acq_rel));
+
+	return true;
+}
+
+void WorkerBudget::giveBack() noexcept
+{
+	this->m_state.fetch_sub(1, std::memory_order_acq_rel);
+}
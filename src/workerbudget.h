@@ -0,0 +1,54 @@
+#ifndef WORKERBUDGET_H
+#define WORKERBUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class ThreadPoolPrivate;
+
+/*
+ * A fixed number of worker tokens shared by several ThreadPools (see
+ * ThreadPool::setWorkerBudget()). Every active worker of an attached pool
+ * holds one token. Each pool is guaranteed its minimum; tokens beyond the
+ * sum of the minimums are lent to whichever pool asks first and come back
+ * when its workers park or retire.
+ *
+ * No more than capacity() workers of the attached pools are ever active at
+ * once: a worker that cannot get a token stays parked. The parked worker
+ * that polls for I/O keeps its token, so that it can run a callback as soon
+ * as it wakes up. Threads marked with ThreadPool::reserveThread() belong to
+ * the caller and take no token. The one exception is a pool attached while
+ * its workers are busy: these finish their current tasks first and only then
+ * give up what the pool got no tokens for.
+ *
+ * The budget is lock-free and must outlive the pools attached to it.
+ */
+class WorkerBudget {
+public:
+	// 0 means one token per hardware thread
+	explicit WorkerBudget(std::size_t tokens = 0);
+
+	WorkerBudget(const WorkerBudget&) = delete;
+	WorkerBudget& operator=(const WorkerBudget&) = delete;
+
+	std::size_t capacity() const noexcept { return this->m_tokens; }
+	std::size_t guaranteed() const noexcept;
+	std::size_t borrowed() const noexcept;
+	// Tokens that can still be borrowed
+	std::size_t available() const noexcept;
+
+private:
+	friend class ThreadPoolPrivate;
+
+	bool reserve(std::size_t minimum) noexcept;
+	void unreserve(std::size_t minimum) noexcept;
+	bool tryBorrow() noexcept;
+	void giveBack() noexcept;
+
+	const std::size_t m_tokens;
+	// Guaranteed tokens in the upper half, borrowed ones in the lower half: both are checked with one CAS
+	std::atomic<std::uint64_t> m_state{0};
+};
+
+#endif // WORKERBUDGET_H
@@ -0,0 +1,134 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/basicthreadpool.h"
+#include "countingrunnable.h"
+
+namespace {
+
+void increment(void* arg)
+{
+    ++*static_cast<std::atomic<int>*>(arg);
+}
+
+TEST(BasicThreadPoolTestSuite, TestFifoFunctionPointer)
+{
+    std::atomic<int> count(0);
+
+    {
+        BasicThreadPool<FifoQueue, BlockingWait, FunctionPointerTask> pool(4);
+        EXPECT_EQ(pool.threadCount(), 4u);
+
+        for (auto i = 0; i < 1000; ++i) {
+            pool.start({ &increment, &count });
+        }
+
+        pool.waitForDone();
+        EXPECT_EQ(count.load(), 1000);
+
+        // Whatever is still queued runs before the destructor returns
+        for (auto i = 0; i < 100; ++i) {
+            pool.start({ &increment, &count });
+        }
+    }
+
+    EXPECT_EQ(count.load(), 1100);
+}
+
+TEST(BasicThreadPoolTestSuite, TestPriorityRunnable)
+{
+    std::atomic<int> count(0);
+    std::atomic<bool> release(false);
+    std::mutex mutex;
+    std::vector<int> order;
+
+    BasicThreadPool<PriorityQueue, SpinWait, RunnableTask> pool(1);
+
+    class Blocker : public Runnable {
+    public:
+        explicit Blocker(std::atomic<bool>* release) : m_release(release) {}
+
+        void run() override
+        {
+            while (!*this->m_release) {
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        std::atomic<bool>* m_release;
+    };
+
+    class Recorder : public Runnable {
+    public:
+        Recorder(std::mutex* mutex, std::vector<int>* order, int id) : m_mutex(mutex), m_order(order), m_id(id) {}
+
+        void run() override
+        {
+            const std::lock_guard<std::mutex> lock(*this->m_mutex);
+            this->m_order->push_back(this->m_id);
+        }
+
+    private:
+        std::mutex* m_mutex;
+        std::vector<int>* m_order;
+        int m_id;
+    };
+
+    pool.start(new Blocker(&release));
+    while (pool.queueSize()) {
+        std::this_thread::yield();
+    }
+
+    pool.start(new Recorder(&mutex, &order, 1), 1);
+    pool.start(new Recorder(&mutex, &order, 3), 3);
+    pool.start(new Recorder(&mutex, &order, 2), 2);
+    pool.start(new Recorder(&mutex, &order, 4), 3);
+    pool.start(new CountingRunnable(&count));
+    release = true;
+
+    pool.waitForDone();
+    EXPECT_EQ(order, (std::vector<int>{ 3, 4, 2, 1 }));
+    EXPECT_EQ(count.load(), 1);
+}
+
+TEST(BasicThreadPoolTestSuite, TestWorkStealingCallable)
+{
+    using Pool = BasicThreadPool<WorkStealingQueue, HybridWait<>, InlineCallableTask<> >;
+
+    std::atomic<int> count(0);
+    Pool pool(4);
+
+    // Tasks spawned from workers land in the spawning worker's own deque and get stolen by the idle ones
+    for (auto i = 0; i < 8; ++i) {
+        pool.start([&pool, &count]() {
+            for (auto j = 0; j < 100; ++j) {
+                pool.start([&count]() { ++count; });
+            }
+        });
+    }
+
+    pool.waitForDone();
+    EXPECT_EQ(count.load(), 800);
+
+    // Too big for the inline buffer: kept on the heap
+    std::array<int, 64> big;
+    big.fill(1);
+    auto shared = std::make_shared<int>(0);
+    pool.start([big, shared, &count]() {
+        count += big[63];
+        ++*shared;
+    });
+
+    pool.waitForDone();
+    EXPECT_EQ(count.load(), 801);
+    EXPECT_EQ(*shared, 1);
+    EXPECT_EQ(shared.use_count(), 1);
+}
+
+} // namespace
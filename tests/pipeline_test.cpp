@@ -0,0 +1,303 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/pipeline.h"
+#include "../src/threadpool.h"
+
+namespace {
+
+void* toItem(std::uintptr_t v)
+{
+    return reinterpret_cast<void*>(v + 1);
+}
+
+std::uintptr_t fromItem(void* item)
+{
+    return reinterpret_cast<std::uintptr_t>(item) - 1;
+}
+
+class Source : public PipelineStage {
+public:
+    Source(std::uintptr_t count, std::atomic<int>* inFlight = nullptr)
+        : PipelineStage(Mode::SerialInOrder), m_count(count), m_inFlight(inFlight)
+    {
+    }
+
+    void* process(void*) override
+    {
+        if (this->m_next == this->m_count) {
+            return nullptr;
+        }
+
+        if (this->m_inFlight) {
+            ++(*this->m_inFlight);
+        }
+
+        return toItem(this->m_next++);
+    }
+
+    void rewind() { this->m_next = 0; }
+
+private:
+    std::uintptr_t m_count;
+    std::uintptr_t m_next = 0;
+    std::atomic<int>* m_inFlight;
+};
+
+class Square : public PipelineStage {
+public:
+    Square(std::atomic<int>* inFlight = nullptr, std::atomic<int>* peak = nullptr)
+        : PipelineStage(Mode::Parallel), m_inFlight(inFlight), m_peak(peak)
+    {
+    }
+
+    void* process(void* item) override
+    {
+        if (this->m_inFlight) {
+            const auto n = this->m_inFlight->load();
+            auto peak    = this->m_peak->load();
+            while (n > peak && !this->m_peak->compare_exchange_weak(peak, n)) {
+            }
+        }
+
+        const auto v = fromItem(item);
+        if (v % 7 == 0) {
+            std::this_thread::yield();
+        }
+
+        return toItem(v * v);
+    }
+
+private:
+    std::atomic<int>* m_inFlight;
+    std::atomic<int>* m_peak;
+};
+
+class Sink : public PipelineStage {
+public:
+    Sink(Mode mode, std::atomic<int>* inFlight = nullptr) : PipelineStage(mode), m_inFlight(inFlight) {}
+
+    void* process(void* item) override
+    {
+        if (this->m_inside.fetch_add(1) != 0) {
+            ++this->overlaps;
+        }
+
+        this->values.push_back(fromItem(item));
+        if (this->m_inFlight) {
+            --(*this->m_inFlight);
+        }
+
+        --this->m_inside;
+        return nullptr;
+    }
+
+    std::vector<std::uintptr_t> values;
+    std::atomic<int> overlaps{0};
+
+private:
+    std::atomic<int> m_inside{0};
+    std::atomic<int>* m_inFlight;
+};
+
+TEST(PipelineTestSuite, TestInOrderOutput)
+{
+    const std::uintptr_t items = 2000;
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(4);
+
+    Source source(items);
+    Square square;
+    Sink sink(PipelineStage::Mode::SerialInOrder);
+
+    Pipeline pipeline(&pool);
+    pipeline.addStage(&source);
+    pipeline.addStage(&square);
+    pipeline.addStage(&sink);
+    EXPECT_EQ(pipeline.stageCount(), 3u);
+
+    EXPECT_EQ(pipeline.run(8), items);
+    ASSERT_EQ(sink.values.size(), items);
+    for (std::uintptr_t i = 0; i < items; ++i) {
+        EXPECT_EQ(sink.values[i], i * i);
+    }
+
+    EXPECT_EQ(sink.overlaps.load(), 0);
+
+    // The pipeline can be run again once the input is rewound
+    source.rewind();
+    sink.values.clear();
+    EXPECT_EQ(pipeline.run(1), items);
+    EXPECT_EQ(sink.values.size(), items);
+    EXPECT_EQ(sink.values.back(), (items - 1) * (items - 1));
+}
+
+TEST(PipelineTestSuite, TestTokenLimit)
+{
+    const std::uintptr_t items = 1000;
+    const int tokens           = 3;
+
+    std::atomic<int> inFlight(0);
+    std::atomic<int> peak(0);
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(8);
+
+    Source source(items, &inFlight);
+    Square square(&inFlight, &peak);
+    Sink sink(PipelineStage::Mode::SerialOutOfOrder, &inFlight);
+
+    Pipeline pipeline(&pool);
+    pipeline.addStage(&source);
+    pipeline.addStage(&square);
+    pipeline.addStage(&sink);
+
+    EXPECT_EQ(pipeline.run(tokens), items);
+    EXPECT_EQ(sink.values.size(), items);
+    EXPECT_EQ(sink.overlaps.load(), 0);
+    EXPECT_EQ(inFlight.load(), 0);
+    EXPECT_GE(peak.load(), 1);
+    EXPECT_LE(peak.load(), tokens);
+}
+
+TEST(PipelineTestSuite, TestFailingStage)
+{
+    class Failing : public PipelineStage {
+    public:
+        Failing() : PipelineStage(Mode::Parallel) {}
+
+        void* process(void* item) override
+        {
+            if (fromItem(item) == 10) {
+                throw std::runtime_error("failed");
+            }
+
+            return item;
+        }
+    };
+
+    const std::uintptr_t items = 100000;
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(4);
+
+    Source source(items);
+    Failing failing;
+    Sink sink(PipelineStage::Mode::SerialInOrder);
+
+    Pipeline pipeline(&pool);
+    pipeline.addStage(&source);
+    pipeline.addStage(&failing);
+    pipeline.addStage(&sink);
+
+    EXPECT_THROW(pipeline.run(4), std::runtime_error);
+
+    // Input stops soon after the failure, and nothing after the failed item reaches later stages
+    EXPECT_LE(sink.values.size(), 10u);
+    for (std::size_t i = 0; i < sink.values.size(); ++i) {
+        EXPECT_EQ(sink.values[i], i);
+    }
+
+    EXPECT_TRUE(pool.waitForDone(5000));
+}
+
+// No address space is that large, so the pool can neither launch nor restart a thread with such a stack
+const std::size_t huge_stack = static_cast<std::size_t>(1) << (sizeof(std::size_t) * 8 - 2);
+
+class HookedSource : public Source {
+public:
+    HookedSource(std::uintptr_t count, std::function<void(std::uintptr_t)> hook) : Source(count), m_hook(std::move(hook)) {}
+
+    void* process(void* item) override
+    {
+        auto* next = Source::process(item);
+        if (next) {
+            this->m_hook(fromItem(next));
+        }
+
+        return next;
+    }
+
+private:
+    std::function<void(std::uintptr_t)> m_hook;
+};
+
+class Hook : public PipelineStage {
+public:
+    explicit Hook(std::function<void(std::uintptr_t)> hook) : PipelineStage(Mode::Parallel), m_hook(std::move(hook)) {}
+
+    void* process(void* item) override
+    {
+        this->m_hook(fromItem(item));
+        return item;
+    }
+
+private:
+    std::function<void(std::uintptr_t)> m_hook;
+};
+
+TEST(PipelineTestSuite, TestPoolRefusesInput)
+{
+    ThreadPool pool;
+    pool.setMaxThreadCount(2);
+
+    // The only worker carries the first item, so the next input task needs a thread the pool cannot launch
+    HookedSource source(100, [&pool](std::uintptr_t v) {
+        if (v == 0) {
+            pool.setStackSize(huge_stack);
+        }
+    });
+
+    Sink sink(PipelineStage::Mode::SerialInOrder);
+
+    Pipeline pipeline(&pool);
+    pipeline.addStage(&source);
+    pipeline.addStage(&sink);
+
+    EXPECT_THROW(pipeline.run(4), std::system_error);
+    EXPECT_TRUE(sink.values.empty());
+
+    pool.setStackSize(0);
+    EXPECT_TRUE(pool.waitForDone(5000));
+}
+
+TEST(PipelineTestSuite, TestPoolRefusesHandOff)
+{
+    ThreadPool pool;
+    pool.setMaxThreadCount(2);
+    pool.setExpiryTimeout(10);
+
+    // The second item waits for the first one at the sink, and its worker retires meanwhile;
+    // handing the second item over then needs a thread the pool cannot restart
+    Source source(100);
+    Hook hook([&pool](std::uintptr_t v) {
+        if (v == 0) {
+            pool.setStackSize(huge_stack);
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+    });
+
+    Sink sink(PipelineStage::Mode::SerialInOrder);
+
+    Pipeline pipeline(&pool);
+    pipeline.addStage(&source);
+    pipeline.addStage(&hook);
+    pipeline.addStage(&sink);
+
+    EXPECT_THROW(pipeline.run(2), std::system_error);
+    ASSERT_EQ(sink.values.size(), 1u);
+    EXPECT_EQ(sink.values[0], 0u);
+
+    pool.setStackSize(0);
+    EXPECT_TRUE(pool.waitForDone(5000));
+}
+
+} // namespace
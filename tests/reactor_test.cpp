@@ -0,0 +1,201 @@
+#ifdef __linux__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "../src/threadpool.h"
+
+namespace {
+
+class Latch {
+public:
+    explicit Latch(int count) : m_count(count) {}
+
+    void countDown()
+    {
+        const std::lock_guard<std::mutex> lock(this->m_mutex);
+        if (--this->m_count <= 0) {
+            this->m_cv.notify_all();
+        }
+    }
+
+    bool wait(unsigned int msecs)
+    {
+        std::unique_lock<std::mutex> lock(this->m_mutex);
+        return this->m_cv.wait_for(lock, std::chrono::milliseconds(msecs), [this] { return this->m_count <= 0; });
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    int m_count;
+};
+
+TEST(ReactorTestSuite, TestPipeReadiness)
+{
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+
+    const auto writes = 100;
+    std::atomic<int> received(0);
+    std::atomic<int> inside(0);
+    std::atomic<int> overlaps(0);
+    std::atomic<int> off_pool(0);
+    Latch done(1);
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(4);
+
+    ASSERT_TRUE(pool.watch(fds[0], ThreadPool::IoRead, [&](int fd, unsigned int events) {
+        if (inside.fetch_add(1) != 0) {
+            ++overlaps;
+        }
+
+        if (ThreadPool::currentWorkerIndex() == ThreadPool::npos) {
+            ++off_pool;
+        }
+
+        EXPECT_TRUE(events & ThreadPool::IoRead);
+
+        char buf[64];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            if ((received += static_cast<int>(n)) == writes) {
+                done.countDown();
+            }
+        }
+
+        --inside;
+    }));
+
+    EXPECT_FALSE(pool.watch(fds[0], ThreadPool::IoRead, [](int, unsigned int) {}));
+
+    for (auto i = 0; i < writes; ++i) {
+        ASSERT_EQ(write(fds[1], "x", 1), 1);
+        if (i % 10 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    EXPECT_TRUE(done.wait(5000));
+    EXPECT_EQ(received.load(), writes);
+    EXPECT_EQ(overlaps.load(), 0);
+    EXPECT_EQ(off_pool.load(), 0);
+
+    // Nothing is delivered once unwatch() has returned
+    EXPECT_TRUE(pool.unwatch(fds[0]));
+    EXPECT_FALSE(pool.unwatch(fds[0]));
+    ASSERT_EQ(write(fds[1], "y", 1), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(received.load(), writes);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(ReactorTestSuite, TestSocketPairPingPong)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+
+    const auto rounds = 50;
+    std::atomic<int> pongs(0);
+    Latch done(1);
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(2);
+
+    // Server side: echo everything back
+    ASSERT_TRUE(pool.watch(sv[1], ThreadPool::IoRead, [](int fd, unsigned int) {
+        char buf[64];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            EXPECT_EQ(write(fd, buf, static_cast<std::size_t>(n)), n);
+        }
+    }));
+
+    // Client side: every reply triggers the next request
+    ASSERT_TRUE(pool.watch(sv[0], ThreadPool::IoRead, [&pongs, &done](int fd, unsigned int) {
+        char buf[64];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            if (++pongs == rounds) {
+                done.countDown();
+            }
+            else {
+                EXPECT_EQ(write(fd, "p", 1), 1);
+            }
+        }
+    }));
+
+    ASSERT_EQ(write(sv[0], "p", 1), 1);
+    EXPECT_TRUE(done.wait(5000));
+    EXPECT_EQ(pongs.load(), rounds);
+
+    // Closing the peer is reported as a hangup
+    Latch hangup(1);
+    EXPECT_TRUE(pool.unwatch(sv[0]));
+    EXPECT_TRUE(pool.watch(sv[0], ThreadPool::IoRead, [&hangup](int, unsigned int events) {
+        if (events & ThreadPool::IoHangup) {
+            hangup.countDown();
+        }
+    }));
+
+    EXPECT_TRUE(pool.unwatch(sv[1]));
+    close(sv[1]);
+    EXPECT_TRUE(hangup.wait(5000));
+
+    EXPECT_TRUE(pool.unwatch(sv[0]));
+    close(sv[0]);
+}
+
+TEST(ReactorTestSuite, TestCallbackException)
+{
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+
+    std::atomic<int> calls(0);
+    std::atomic<int> failures(0);
+    Latch done(2);
+
+    ThreadPool pool;
+    pool.setExceptionHandler([&failures, &done](Runnable* r, std::exception_ptr) {
+        EXPECT_EQ(r, nullptr);
+        ++failures;
+        done.countDown();
+    });
+
+    ASSERT_TRUE(pool.watch(fds[0], ThreadPool::IoRead, [&calls](int fd, unsigned int) {
+        char c;
+        EXPECT_EQ(read(fd, &c, 1), 1);
+        ++calls;
+        throw std::runtime_error("boom");
+    }));
+
+    // The descriptor is re-armed after a throwing callback as well
+    ASSERT_EQ(write(fds[1], "a", 1), 1);
+    while (calls.load() < 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    ASSERT_EQ(write(fds[1], "b", 1), 1);
+    EXPECT_TRUE(done.wait(5000));
+    EXPECT_EQ(calls.load(), 2);
+    EXPECT_EQ(failures.load(), 2);
+
+    EXPECT_TRUE(pool.unwatch(fds[0]));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+} // namespace
+
+#endif
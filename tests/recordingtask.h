@@ -0,0 +1,27 @@
+#ifndef RECORDING_TASK_H
+#define RECORDING_TASK_H
+
+#include <mutex>
+#include <vector>
+#include "../src/runnable.h"
+
+class RecordingTask : public Runnable {
+public:
+	RecordingTask(std::vector<int>* log, std::mutex* mutex, int id)
+		: m_log(log), m_mutex(mutex), m_id(id)
+	{
+	}
+
+	void run() override
+	{
+		const std::lock_guard<std::mutex> lock(*this->m_mutex);
+		this->m_log->push_back(this->m_id);
+	}
+
+private:
+	std::vector<int>* m_log;
+	std::mutex* m_mutex;
+	int m_id;
+};
+
+#endif // RECORDING_TASK_H
@@ -0,0 +1,299 @@
+/*
+ * Scalability harness: runs fixed workloads at 1, 2, 4 ... N threads and
+ * writes throughput, speedup, efficiency and rusage counters to a CSV.
+ * With --baseline it compares against an earlier CSV and exits with 1 if
+ * any workload lost more than --threshold percent of its throughput.
+ *
+ * Not part of ctest: timings on shared CI machines are too noisy.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../src/runnable.h"
+#include "../src/threadpool.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Usage {
+    long voluntary   = 0;
+    long involuntary = 0;
+    double user      = 0;
+    double system    = 0;
+};
+
+Usage usage()
+{
+    Usage u;
+#if defined(__unix__) || defined(__APPLE__)
+    rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        u.voluntary   = ru.ru_nvcsw;
+        u.involuntary = ru.ru_nivcsw;
+        u.user        = static_cast<double>(ru.ru_utime.tv_sec) + ru.ru_utime.tv_usec / 1e6;
+        u.system      = static_cast<double>(ru.ru_stime.tv_sec) + ru.ru_stime.tv_usec / 1e6;
+    }
+#endif
+    return u;
+}
+
+void spin(unsigned int usecs)
+{
+    if (usecs) {
+        const auto until = clock_type::now() + std::chrono::microseconds(usecs);
+        while (clock_type::now() < until) {
+        }
+    }
+}
+
+class SpinTask : public Runnable {
+public:
+    SpinTask(std::atomic<std::size_t>* done, unsigned int usecs) : m_done(done), m_usecs(usecs) {}
+
+    void run() override
+    {
+        spin(this->m_usecs);
+        ++*this->m_done;
+    }
+
+private:
+    std::atomic<std::size_t>* m_done;
+    unsigned int m_usecs;
+};
+
+// Submits its children from the worker, the way recursive divide-and-conquer code does
+class NestedTask : public Runnable {
+public:
+    NestedTask(ThreadPool* pool, std::atomic<std::size_t>* done, std::size_t children)
+        : m_pool(pool), m_done(done), m_children(children)
+    {
+    }
+
+    void run() override
+    {
+        for (std::size_t i = 0; i < this->m_children; ++i) {
+            this->m_pool->start(new SpinTask(this->m_done, 1));
+        }
+
+        ++*this->m_done;
+    }
+
+private:
+    ThreadPool* m_pool;
+    std::atomic<std::size_t>* m_done;
+    std::size_t m_children;
+};
+
+struct Workload {
+    const char* name;
+    // Submits the work and returns the number of tasks that will complete
+    std::size_t (*submit)(ThreadPool* pool, std::atomic<std::size_t>* done, std::size_t tasks);
+};
+
+std::size_t spinning(ThreadPool* pool, std::atomic<std::size_t>* done, std::size_t tasks, unsigned int usecs, bool priorities)
+{
+    for (std::size_t i = 0; i < tasks; ++i) {
+        pool->start(new SpinTask(done, usecs), priorities ? static_cast<int>(i % 8) : 0);
+    }
+
+    return tasks;
+}
+
+const Workload workloads[] = {
+    { "empty", [](ThreadPool* p, std::atomic<std::size_t>* d, std::size_t n) { return spinning(p, d, n, 0, false); } },
+    { "cpu-1us", [](ThreadPool* p, std::atomic<std::size_t>* d, std::size_t n) { return spinning(p, d, n, 1, false); } },
+    { "cpu-10us", [](ThreadPool* p, std::atomic<std::size_t>* d, std::size_t n) { return spinning(p, d, n / 4, 10, false); } },
+    { "cpu-100us", [](ThreadPool* p, std::atomic<std::size_t>* d, std::size_t n) { return spinning(p, d, n / 40, 100, false); } },
+    { "nested", [](ThreadPool* p, std::atomic<std::size_t>* d, std::size_t n) {
+        const std::size_t children = 15;
+        const auto roots           = n / (children + 1);
+        for (std::size_t i = 0; i < roots; ++i) {
+            p->start(new NestedTask(p, d, children));
+        }
+
+        return roots * (children + 1);
+    } },
+    { "mixed-priority", [](ThreadPool* p, std::atomic<std::size_t>* d, std::size_t n) { return spinning(p, d, n, 1, true); } },
+};
+
+struct Result {
+    std::string workload;
+    std::size_t threads = 0;
+    std::size_t tasks   = 0;
+    double seconds      = 0;
+    Usage usage;
+};
+
+Result measure(const Workload& w, std::size_t threads, std::size_t tasks, unsigned int repeat)
+{
+    ThreadPool pool;
+    pool.setMaxThreadCount(threads);
+
+    Result best;
+    best.workload = w.name;
+    best.threads  = threads;
+
+    // The first round only spawns the workers
+    for (unsigned int round = 0; round <= repeat; ++round) {
+        std::atomic<std::size_t> done(0);
+        const auto before = usage();
+        const auto start  = clock_type::now();
+
+        const auto expected = w.submit(&pool, &done, tasks);
+        while (done.load() < expected) {
+            std::this_thread::yield();
+        }
+
+        pool.drain();
+        const auto seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+        const auto after   = usage();
+
+        if (round && (best.seconds == 0 || seconds < best.seconds)) {
+            best.tasks             = expected;
+            best.seconds           = seconds;
+            best.usage.voluntary   = after.voluntary - before.voluntary;
+            best.usage.involuntary = after.involuntary - before.involuntary;
+            best.usage.user        = after.user - before.user;
+            best.usage.system      = after.system - before.system;
+        }
+    }
+
+    return best;
+}
+
+std::map<std::pair<std::string, std::size_t>, double> readBaseline(const std::string& path)
+{
+    std::map<std::pair<std::string, std::size_t>, double> throughput;
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line)) {
+        std::istringstream row(line);
+        std::string workload, threads, tasks, seconds, tput;
+        if (std::getline(row, workload, ',') && std::getline(row, threads, ',') && std::getline(row, tasks, ',')
+            && std::getline(row, seconds, ',') && std::getline(row, tput, ',')
+        ) {
+            throughput[std::make_pair(workload, std::stoul(threads))] = std::stod(tput);
+        }
+    }
+
+    return throughput;
+}
+
+void usageAndExit(const char* self)
+{
+    std::cerr
+        << "Usage: " << self << " [--threads N] [--tasks N] [--repeat N] [--workload NAME]\n"
+        << "       [--csv FILE] [--baseline FILE] [--threshold PERCENT]\n";
+    std::exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::size_t tasks       = 200000;
+    unsigned int repeat     = 3;
+    double threshold        = 10;
+    std::string only;
+    std::string csv;
+    std::string baseline;
+
+    for (int i = 1; i < argc; ++i) {
+        const auto has_value = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--threads") && has_value) {
+            max_threads = std::max<std::size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+        }
+        else if (!std::strcmp(argv[i], "--tasks") && has_value) {
+            tasks = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!std::strcmp(argv[i], "--repeat") && has_value) {
+            repeat = std::max(static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10)), 1u);
+        }
+        else if (!std::strcmp(argv[i], "--workload") && has_value) {
+            only = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--csv") && has_value) {
+            csv = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--baseline") && has_value) {
+            baseline = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--threshold") && has_value) {
+            threshold = std::strtod(argv[++i], nullptr);
+        }
+        else {
+            usageAndExit(argv[0]);
+        }
+    }
+
+    std::vector<std::size_t> counts;
+    for (std::size_t n = 1; n < max_threads; n *= 2) {
+        counts.push_back(n);
+    }
+
+    counts.push_back(max_threads);
+
+    std::ofstream file;
+    if (!csv.empty()) {
+        file.open(csv);
+        if (!file) {
+            std::cerr << "Cannot write " << csv << "\n";
+            return 2;
+        }
+    }
+
+    std::ostream& out = csv.empty() ? std::cout : file;
+    out << "workload,threads,tasks,seconds,tasks_per_second,speedup,efficiency,"
+           "voluntary_switches,involuntary_switches,user_seconds,system_seconds\n";
+
+    const auto reference = baseline.empty() ? decltype(readBaseline(baseline))() : readBaseline(baseline);
+    auto regressions     = 0;
+
+    for (const auto& w : workloads) {
+        if (!only.empty() && only != w.name) {
+            continue;
+        }
+
+        double single = 0;
+        for (auto threads : counts) {
+            const auto r          = measure(w, threads, tasks, repeat);
+            const auto throughput = r.seconds > 0 ? static_cast<double>(r.tasks) / r.seconds : 0;
+            if (threads == 1) {
+                single = throughput;
+            }
+
+            const auto speedup = single > 0 ? throughput / single : 0;
+            out << r.workload << ',' << r.threads << ',' << r.tasks << ',' << r.seconds << ',' << throughput << ','
+                << speedup << ',' << speedup / static_cast<double>(threads) << ',' << r.usage.voluntary << ','
+                << r.usage.involuntary << ',' << r.usage.user << ',' << r.usage.system << '\n';
+
+            const auto it = reference.find(std::make_pair(r.workload, r.threads));
+            if (it != reference.end() && throughput < it->second * (1 - threshold / 100)) {
+                std::cerr
+                    << "REGRESSION " << r.workload << " @ " << r.threads << " threads: "
+                    << throughput << " tasks/s vs " << it->second << " in the baseline\n";
+                ++regressions;
+            }
+        }
+    }
+
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/shardedthreadpool.h"
+#include "../src/threadpool.h"
+
+#include "countingrunnable.h"
+#include "semaphore.h"
+#include "waitingtask.h"
+
+namespace {
+
+TEST(ShardedThreadPoolTestSuite, TestRunOnAllShards)
+{
+    std::atomic<int> count(0);
+    const auto runs = 1000;
+
+    {
+        ShardedThreadPool pool(4, 1);
+        EXPECT_EQ(pool.shardCount(), 4);
+
+        for (auto i = 0; i < runs; ++i) {
+            pool.startKeyed(static_cast<std::size_t>(i), new CountingRunnable(&count));
+            pool.start(new CountingRunnable(&count));
+        }
+
+        EXPECT_TRUE(pool.waitForDone());
+        EXPECT_EQ(count.load(std::memory_order_relaxed), 2 * runs);
+        EXPECT_EQ(pool.queueSize(), 0);
+    }
+}
+
+thread_local std::size_t t_shard = ThreadPool::npos;
+
+class ShardCheckTask : public Runnable {
+public:
+    ShardCheckTask(std::size_t shard, std::atomic<int>* count, std::atomic<int>* misplaced)
+        : m_shard(shard), m_count(count), m_misplaced(misplaced)
+    {
+    }
+
+    void run() override
+    {
+        if (t_shard != this->m_shard) {
+            ++(*this->m_misplaced);
+        }
+
+        ++(*this->m_count);
+    }
+
+private:
+    std::size_t m_shard;
+    std::atomic<int>* m_count;
+    std::atomic<int>* m_misplaced;
+};
+
+class BlockerTask : public Runnable {
+public:
+    BlockerTask(std::atomic<int>* started, semaphore* gate) : m_started(started), m_gate(gate) {}
+
+    void run() override
+    {
+        ++(*this->m_started);
+        this->m_gate->acquire();
+    }
+
+private:
+    std::atomic<int>* m_started;
+    semaphore* m_gate;
+};
+
+TEST(ShardedThreadPoolTestSuite, TestKeyAffinity)
+{
+    const std::size_t shards = 4;
+    const auto runs          = 20;
+
+    ShardedThreadPool pool(shards, 1);
+    for (std::size_t i = 0; i < shards; ++i) {
+        pool.shard(i).setThreadStartHook([i](std::size_t) { t_shard = i; });
+    }
+
+    // Keys landing on different shards
+    std::vector<std::size_t> keys;
+    std::set<std::size_t> used;
+    for (std::size_t key = 0; keys.size() < 3 && key < 1000; ++key) {
+        EXPECT_LT(pool.shardIndex(key), pool.shardCount());
+        if (used.insert(pool.shardIndex(key)).second) {
+            keys.push_back(key);
+        }
+    }
+
+    ASSERT_EQ(keys.size(), 3u);
+
+    for (auto key : keys) {
+        const auto owner = pool.shardIndex(key);
+
+        // With every shard's only worker blocked nothing can be stolen, so the tasks stay where they were put
+        std::atomic<int> started(0);
+        semaphore ownerGate;
+        semaphore othersGate;
+        for (std::size_t i = 0; i < shards; ++i) {
+            pool.shard(i).start(new BlockerTask(&started, i == owner ? &ownerGate : &othersGate));
+        }
+
+        const auto till = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (started.load() < static_cast<int>(shards) && std::chrono::steady_clock::now() < till) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        ASSERT_EQ(started.load(), static_cast<int>(shards));
+
+        std::atomic<int> count(0);
+        std::atomic<int> misplaced(0);
+        for (auto i = 0; i < runs; ++i) {
+            pool.startKeyed(key, new ShardCheckTask(owner, &count, &misplaced));
+        }
+
+        for (std::size_t i = 0; i < shards; ++i) {
+            EXPECT_EQ(pool.shard(i).queueSize(), i == owner ? static_cast<std::size_t>(runs) : 0u);
+        }
+
+        // Only the owner is let go; the others are still blocked and cannot take anything
+        ownerGate.release();
+        while (count.load() < runs && std::chrono::steady_clock::now() < till) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        EXPECT_EQ(count.load(), runs);
+        EXPECT_EQ(misplaced.load(), 0);
+
+        othersGate.release(static_cast<int>(shards - 1));
+        EXPECT_TRUE(pool.waitForDone());
+    }
+}
+
+TEST(ShardedThreadPoolTestSuite, TestIdleShardSteals)
+{
+    std::atomic<int> blocked(0);
+    std::atomic<int> count(0);
+    WaitingTask blocker(&blocked);
+    ShardedThreadPool pool(2, 1);
+
+    const std::size_t key = 42;
+    const auto runs       = 10;
+
+    pool.startKeyed(key, &blocker);
+    for (auto i = 0; i < runs; ++i) {
+        pool.startKeyed(key, new CountingRunnable(&count));
+    }
+
+    // The owning shard's only worker is blocked, so the other shard has to run everything
+    const auto till = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (count.load(std::memory_order_relaxed) < runs && std::chrono::steady_clock::now() < till) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    EXPECT_EQ(count.load(std::memory_order_relaxed), runs);
+    EXPECT_EQ(blocked.load(std::memory_order_relaxed), 0);
+
+    blocker.release(1);
+    EXPECT_TRUE(pool.waitForDone());
+    EXPECT_EQ(blocked.load(std::memory_order_relaxed), 1);
+}
+
+} // namespace
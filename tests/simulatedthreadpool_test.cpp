@@ -0,0 +1,168 @@
+#include <atomic>
+#include <set>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/runnable.h"
+#include "../src/simulatedthreadpool.h"
+#include "countingrunnable.h"
+
+namespace {
+
+class RecordingTask : public Runnable {
+public:
+    RecordingTask(std::vector<int>* order, int id) : m_order(order), m_id(id) {}
+
+    void run() override
+    {
+        this->m_order->push_back(this->m_id);
+    }
+
+private:
+    std::vector<int>* m_order;
+    int m_id;
+};
+
+std::vector<int> schedule(std::uint32_t seed)
+{
+    std::vector<int> order;
+    SimulatedThreadPool pool(seed, 4);
+    for (auto i = 0; i < 16; ++i) {
+        pool.start(new RecordingTask(&order, i));
+    }
+
+    EXPECT_TRUE(pool.waitForDone());
+    return order;
+}
+
+TEST(SimulatedThreadPoolTestSuite, TestSeededSchedule)
+{
+    std::set<std::vector<int> > orders;
+    for (std::uint32_t seed = 0; seed < 8; ++seed) {
+        const auto order = schedule(seed);
+        EXPECT_EQ(order.size(), 16u);
+        EXPECT_EQ(order, schedule(seed));
+        orders.insert(order);
+    }
+
+    // Tasks held by different workers complete in seed-dependent order
+    EXPECT_GT(orders.size(), 1u);
+
+    // With a single worker only the queue order is left
+    std::vector<int> order;
+    SimulatedThreadPool pool(1, 1);
+    pool.start(new RecordingTask(&order, 0));
+    pool.start(new RecordingTask(&order, 1), 1);
+    pool.start(new RecordingTask(&order, 2), 2);
+    pool.start(new RecordingTask(&order, 3), 2);
+    EXPECT_TRUE(pool.waitForDone());
+    EXPECT_EQ(order, (std::vector<int>{ 0, 2, 3, 1 }));
+}
+
+TEST(SimulatedThreadPoolTestSuite, TestVirtualTime)
+{
+    std::atomic<int> count(0);
+    std::vector<std::size_t> started;
+    std::vector<std::size_t> exited;
+
+    SimulatedThreadPool pool(7, 2);
+    pool.setExpiryTimeout(1000);
+    pool.setThreadStartHook([&started](std::size_t i) { started.push_back(i); });
+    pool.setThreadExitHook([&exited](std::size_t i) { exited.push_back(i); });
+
+    pool.start(new CountingRunnable(&count));
+    pool.start(new CountingRunnable(&count));
+    EXPECT_EQ(pool.activeThreadCount(), 2u);
+    EXPECT_EQ(started, (std::vector<std::size_t>{ 0, 1 }));
+
+    while (pool.step()) {
+    }
+
+    EXPECT_EQ(count.load(), 2);
+    EXPECT_EQ(pool.now(), 2u);
+    EXPECT_EQ(pool.threadCount(), 2u);
+
+    // Idle workers expire once a second of virtual time has gone by, without anybody sleeping
+    pool.advance(999);
+    EXPECT_EQ(pool.threadCount(), 1u);
+    pool.advance(1);
+    EXPECT_EQ(pool.threadCount(), 0u);
+    EXPECT_EQ(exited.size(), 2u);
+
+    // A task that keeps resubmitting itself never lets the pool finish
+    class Forever : public Runnable {
+    public:
+        explicit Forever(SimulatedThreadPool* pool) : m_pool(pool) { this->setAutoDelete(false); }
+        void stop() { this->m_stop = true; }
+
+        void run() override
+        {
+            if (!this->m_stop) {
+                this->m_pool->start(this);
+            }
+        }
+
+    private:
+        SimulatedThreadPool* m_pool;
+        bool m_stop = false;
+    };
+
+    Forever forever(&pool);
+    pool.setStepDuration(10);
+    pool.start(&forever);
+
+    const auto before = pool.now();
+    EXPECT_FALSE(pool.waitForDone(100));
+    EXPECT_EQ(pool.now() - before, 100u);
+
+    // The task is always held by a worker, never queued, so only stopping it helps
+    forever.stop();
+    EXPECT_TRUE(pool.waitForDone(10));
+    EXPECT_EQ(pool.now() - before, 110u);
+}
+
+TEST(SimulatedThreadPoolTestSuite, TestNestedAndFailing)
+{
+    std::atomic<int> count(0);
+    std::vector<std::size_t> workers;
+    int failures = 0;
+
+    SimulatedThreadPool pool(3, 3);
+    pool.setExceptionHandler([&failures](Runnable*, std::exception_ptr) { ++failures; });
+
+    class Spawner : public Runnable {
+    public:
+        Spawner(SimulatedThreadPool* pool, std::atomic<int>* count, std::vector<std::size_t>* workers)
+            : m_pool(pool), m_count(count), m_workers(workers)
+        {
+        }
+
+        void run() override
+        {
+            this->m_workers->push_back(this->m_pool->currentWorkerIndex());
+            for (auto i = 0; i < 4; ++i) {
+                this->m_pool->start(new CountingRunnable(this->m_count));
+            }
+
+            throw std::runtime_error("spawned");
+        }
+
+    private:
+        SimulatedThreadPool* m_pool;
+        std::atomic<int>* m_count;
+        std::vector<std::size_t>* m_workers;
+    };
+
+    pool.start(new Spawner(&pool, &count, &workers));
+    pool.start(new Spawner(&pool, &count, &workers));
+    EXPECT_EQ(pool.currentWorkerIndex(), SimulatedThreadPool::npos);
+
+    EXPECT_TRUE(pool.waitForDone());
+    EXPECT_EQ(count.load(), 8);
+    EXPECT_EQ(failures, 2);
+    EXPECT_EQ(workers.size(), 2u);
+    EXPECT_NE(workers[0], workers[1]);
+    EXPECT_EQ(pool.threadCount(), 0u);
+}
+
+} // namespace
@@ -0,0 +1,75 @@
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/slotarray.h"
+
+namespace {
+
+struct Counter {
+    explicit Counter(int* alive, bool fail = false) : alive(alive)
+    {
+        if (fail) {
+            throw std::runtime_error("constructor failed");
+        }
+
+        ++*this->alive;
+    }
+
+    ~Counter() { --*this->alive; }
+
+    int* alive;
+};
+
+TEST(SlotArrayTestSuite, TestLayout)
+{
+    int alive = 0;
+    SlotArray<Counter> slots;
+
+    std::vector<Counter*> objects;
+    for (auto i = 0; i < 20; ++i) {
+        objects.push_back(slots.create(&alive));
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(objects.back()) % cache_line_size, 0u);
+    }
+
+    EXPECT_EQ(alive, 20);
+
+    // The first four share one array, one line apart; growing does not move them
+    for (auto i = 1; i < 4; ++i) {
+        EXPECT_EQ(reinterpret_cast<char*>(objects[i]) - reinterpret_cast<char*>(objects[i - 1]), static_cast<std::ptrdiff_t>(cache_line_size));
+    }
+
+    EXPECT_EQ(std::set<Counter*>(objects.begin(), objects.end()).size(), objects.size());
+
+    for (auto* object : objects) {
+        slots.destroy(object);
+    }
+
+    EXPECT_EQ(alive, 0);
+}
+
+TEST(SlotArrayTestSuite, TestReuse)
+{
+    int alive = 0;
+    SlotArray<Counter> slots;
+
+    auto* a = slots.create(&alive);
+    auto* b = slots.create(&alive);
+    slots.destroy(a);
+    EXPECT_EQ(slots.create(&alive), a);
+
+    // A constructor that throws leaves its slot to the next object
+    EXPECT_THROW(slots.create(&alive, true), std::runtime_error);
+    auto* c = slots.create(&alive);
+    EXPECT_NE(c, a);
+    EXPECT_NE(c, b);
+    EXPECT_EQ(alive, 3);
+
+    slots.destroy(a);
+    slots.destroy(b);
+    slots.destroy(c);
+    EXPECT_EQ(alive, 0);
+}
+
+} // namespace
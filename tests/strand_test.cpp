@@ -0,0 +1,159 @@
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/strand.h"
+#include "../src/threadpool.h"
+
+namespace {
+
+class SerialCheckTask : public Runnable {
+public:
+    SerialCheckTask(const Strand* strand, std::atomic<int>* inside, std::atomic<int>* overlaps, std::vector<std::pair<int, int> >* log, int producer, int seq)
+        : m_strand(strand), m_inside(inside), m_overlaps(overlaps), m_log(log), m_producer(producer), m_seq(seq)
+    {
+    }
+
+    void run() override
+    {
+        if (this->m_inside->fetch_add(1) != 0 || !this->m_strand->runningInThisThread()) {
+            ++(*this->m_overlaps);
+        }
+
+        this->m_log->emplace_back(this->m_producer, this->m_seq);
+        --(*this->m_inside);
+    }
+
+private:
+    const Strand* m_strand;
+    std::atomic<int>* m_inside;
+    std::atomic<int>* m_overlaps;
+    std::vector<std::pair<int, int> >* m_log;
+    int m_producer;
+    int m_seq;
+};
+
+TEST(StrandTestSuite, TestSerialFifoExecution)
+{
+    const auto producers = 4;
+    const auto runs      = 2000;
+
+    std::atomic<int> inside(0);
+    std::atomic<int> overlaps(0);
+    std::vector<std::pair<int, int> > log;
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(4);
+
+    {
+        Strand strand(&pool, 16);
+        std::vector<std::thread> threads;
+        for (auto p = 0; p < producers; ++p) {
+            threads.emplace_back([&strand, &inside, &overlaps, &log, p]() {
+                for (auto i = 0; i < runs; ++i) {
+                    strand.post(new SerialCheckTask(&strand, &inside, &overlaps, &log, p, i));
+                }
+            });
+        }
+
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        EXPECT_FALSE(strand.runningInThisThread());
+    }
+
+    EXPECT_EQ(overlaps.load(), 0);
+    ASSERT_EQ(log.size(), static_cast<std::size_t>(producers * runs));
+
+    std::vector<int> next(producers, 0);
+    for (auto& entry : log) {
+        EXPECT_EQ(entry.second, next[entry.first]);
+        next[entry.first] = entry.second + 1;
+    }
+}
+
+TEST(StrandTestSuite, TestStrandsRunInParallel)
+{
+    std::atomic<int> count(0);
+    ThreadPool pool;
+
+    {
+        Strand a(&pool);
+        Strand b(&pool);
+
+        class Increment : public Runnable {
+        public:
+            explicit Increment(std::atomic<int>* count) : m_count(count) {}
+            void run() override { ++(*this->m_count); }
+
+        private:
+            std::atomic<int>* m_count;
+        };
+
+        for (auto i = 0; i < 100; ++i) {
+            a.post(new Increment(&count));
+            b.post(new Increment(&count));
+        }
+    }
+
+    EXPECT_EQ(count.load(), 200);
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+TEST(StrandTestSuite, TestExceptionDoesNotStallStrand)
+{
+    class Throwing : public Runnable {
+    public:
+        void run() override { throw std::logic_error("boom"); }
+    };
+
+    class Increment : public Runnable {
+    public:
+        explicit Increment(std::atomic<int>* count) : m_count(count) {}
+        void run() override { ++(*this->m_count); }
+
+    private:
+        std::atomic<int>* m_count;
+    };
+
+    std::atomic<int> count(0);
+    std::atomic<int> failures(0);
+    std::atomic<int> foreign(0);
+    std::set<Runnable*> throwing;
+    ThreadPool pool;
+
+    // The handler sees the task that failed, not the strand's dispatcher, and before the task is deleted
+    pool.setExceptionHandler([&failures, &foreign, &throwing](Runnable* r, std::exception_ptr) {
+        ++failures;
+        if (!throwing.count(r) || !dynamic_cast<Throwing*>(r)) {
+            ++foreign;
+        }
+    });
+
+    std::vector<Runnable*> tasks;
+    for (auto i = 0; i < 50; ++i) {
+        tasks.push_back(new Throwing());
+        throwing.insert(tasks.back());
+        tasks.push_back(new Increment(&count));
+    }
+
+    {
+        Strand strand(&pool);
+        for (auto* r : tasks) {
+            strand.post(r);
+        }
+    }
+
+    EXPECT_TRUE(pool.waitForDone());
+    EXPECT_EQ(count.load(), 50);
+    EXPECT_EQ(failures.load(), 50);
+    EXPECT_EQ(foreign.load(), 0);
+    EXPECT_EQ(pool.stats().failedTasks, 50u);
+}
+
+} // namespace
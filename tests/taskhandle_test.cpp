@@ -0,0 +1,170 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/taskhandle.h"
+#include "../src/threadpool.h"
+
+namespace {
+
+TEST(TaskHandleTestSuite, TestSubmitAndGet)
+{
+    ThreadPool pool;
+
+    auto answer = pool.submit([]() { return 42; });
+    auto text   = pool.submit([]() { return std::string("hello"); });
+    std::atomic<bool> ran(false);
+    auto nothing = pool.submit([&ran]() { ran = true; });
+
+    EXPECT_EQ(answer.get(), 42);
+    EXPECT_EQ(text.get(), "hello");
+    nothing.get();
+    EXPECT_TRUE(ran.load());
+    EXPECT_TRUE(answer.isReady());
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+TEST(TaskHandleTestSuite, TestExceptionIsStoredInHandle)
+{
+    std::atomic<int> failures(0);
+    ThreadPool pool;
+    pool.setExceptionHandler([&failures](Runnable*, std::exception_ptr) { ++failures; });
+
+    auto h = pool.submit([]() -> int { throw std::runtime_error("boom"); });
+    EXPECT_THROW(h.get(), std::runtime_error);
+    EXPECT_TRUE(pool.waitForDone());
+    EXPECT_EQ(failures.load(), 0);
+}
+
+TEST(TaskHandleTestSuite, TestThenChain)
+{
+    ThreadPool pool;
+
+    auto h = pool.submit([]() { return 1; })
+        .then([](TaskHandle<int> prev) { return prev.get() + 1; })
+        .then([](TaskHandle<int> prev) { return prev.get() * 10; }, Launch::Inline)
+        .then([](TaskHandle<int> prev) { return std::to_string(prev.get()); });
+
+    EXPECT_EQ(h.get(), "20");
+
+    // Errors propagate through get() of the antecedent
+    auto failed = pool.submit([]() -> int { throw std::logic_error("boom"); })
+        .then([](TaskHandle<int> prev) {
+            try {
+                prev.get();
+            }
+            catch (const std::logic_error&) {
+                return -1;
+            }
+
+            return 0;
+        });
+
+    EXPECT_EQ(failed.get(), -1);
+
+    // Registered after completion: runs right away
+    auto done = pool.submit([]() { return 5; });
+    done.wait();
+    auto late = done.then([](TaskHandle<int> prev) { return prev.get() + 1; }, Launch::Inline);
+    EXPECT_TRUE(late.isReady());
+    EXPECT_EQ(late.get(), 6);
+
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+TEST(TaskHandleTestSuite, TestThenWhenPoolRefuses)
+{
+    ThreadPool pool;
+    pool.setMaxThreadCount(2);
+
+    std::atomic<bool> release(false);
+    auto first = pool.submit([&release]() {
+        while (!release) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return 1;
+    });
+
+    auto next = first.then([](TaskHandle<int>& h) { return h.get() + 1; });
+
+    // The continuation needs a second thread, and no address space is large enough for its stack
+    pool.setStackSize(static_cast<std::size_t>(1) << (sizeof(std::size_t) * 8 - 2));
+    release = true;
+
+    EXPECT_EQ(first.get(), 1);
+    EXPECT_THROW(next.get(), std::system_error);
+
+    pool.setStackSize(0);
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+TEST(TaskHandleTestSuite, TestWhenAllAndWhenAny)
+{
+    ThreadPool pool;
+    pool.setMaxThreadCount(4);
+
+    std::vector<TaskHandle<int> > tasks;
+    for (auto i = 0; i < 20; ++i) {
+        tasks.push_back(pool.submit([i]() { return i; }));
+    }
+
+    auto sum = whenAll(tasks).then([](TaskHandle<std::vector<TaskHandle<int> > > all) {
+        auto total = 0;
+        for (auto& t : all.get()) {
+            EXPECT_TRUE(t.isReady());
+            total += t.get();
+        }
+
+        return total;
+    });
+
+    EXPECT_EQ(sum.get(), 190);
+
+    std::atomic<bool> release(false);
+    std::vector<TaskHandle<int> > race;
+    race.push_back(pool.submit([&release]() {
+        while (!release) {
+            std::this_thread::yield();
+        }
+
+        return 0;
+    }));
+    race.push_back(pool.submit([]() { return 1; }));
+
+    auto first = whenAny(race);
+    EXPECT_EQ(first.get(), 1u);
+    release = true;
+
+    EXPECT_EQ(whenAll(std::vector<TaskHandle<int> >()).get().size(), 0u);
+    EXPECT_EQ(whenAny(std::vector<TaskHandle<int> >()).get(), ThreadPool::npos);
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+TEST(TaskHandleTestSuite, TestClearBreaksPromise)
+{
+    ThreadPool pool;
+    pool.setMaxThreadCount(1);
+
+    std::atomic<bool> release(false);
+    auto blocker = pool.submit([&release]() {
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+
+    auto dropped = pool.submit([]() { return 1; });
+    pool.clear();
+    release = true;
+
+    EXPECT_THROW(dropped.get(), std::future_error);
+    blocker.get();
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+} // namespace
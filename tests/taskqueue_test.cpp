@@ -0,0 +1,117 @@
+#include <chrono>
+#include <random>
+#include <utility>
+#include <vector>
+#include <thread>
+#include <gtest/gtest.h>
+#include "../src/runnable.h"
+#include "../src/taskqueue.h"
+
+namespace {
+
+class NoopTask : public Runnable {
+public:
+    NoopTask() { this->setAutoDelete(false); }
+    void run() override {}
+};
+
+TEST(TaskQueueTestSuite, TestPushAfterFront)
+{
+    NoopTask low;
+    NoopTask high;
+    NoopTask higher;
+    TaskQueue queue;
+
+    queue.push(&low, 1);
+    EXPECT_EQ(queue.front(), &low);
+
+    // front() without pop_front() (a dispatch that could not start a thread) must not pin the old pick
+    queue.push(&high, 5);
+    EXPECT_EQ(queue.front(), &high);
+    queue.pop_front();
+    EXPECT_EQ(queue.front(), &low);
+
+    queue.push(&higher, 9);
+    queue.pop_front();
+    EXPECT_EQ(queue.size(), 1u);
+    EXPECT_EQ(queue.front(), &low);
+    queue.pop_front();
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(TaskQueueTestSuite, TestDeadlinesDoNotStarveAgedTasks)
+{
+    NoopTask plain;
+    NoopTask urgent;
+    NoopTask later;
+    TaskQueue queue;
+    const auto far = TaskQueue::clock::now() + std::chrono::hours(1);
+
+    // Without aging the deadline lane always wins
+    queue.push(&plain, 100);
+    queue.push(&urgent, 0, far);
+    EXPECT_EQ(queue.front(), &urgent);
+
+    queue.setAging(10, 2);
+    queue.remove(&plain);
+    queue.push(&plain, 100);
+    EXPECT_EQ(queue.front(), &urgent);
+
+    // Once the priority task has gained the full boost it goes first, however many deadline tasks keep coming
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    queue.push(&later, 0, far);
+    EXPECT_EQ(queue.front(), &plain);
+    queue.pop_front();
+
+    EXPECT_EQ(queue.front(), &urgent);
+    queue.pop_front();
+    EXPECT_EQ(queue.front(), &later);
+    queue.pop_front();
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(TaskQueueTestSuite, TestDeadlineOrder)
+{
+    const auto runs = 2000;
+    const auto now  = TaskQueue::clock::now();
+
+    std::vector<NoopTask> tasks(runs);
+    std::vector<TaskQueue::clock::time_point> deadlines(runs);
+    std::mt19937 rng(42);
+    TaskQueue queue;
+
+    // Deadlines repeat a lot, and half of them are already over
+    for (auto i = 0; i < runs; ++i) {
+        deadlines[i] = now + std::chrono::milliseconds(static_cast<int>(rng() % 200) - 100) * 1000;
+        queue.push(&tasks[i], 0, deadlines[i]);
+    }
+
+    auto removed = 0;
+    for (auto i = 0; i < runs; i += 7) {
+        EXPECT_TRUE(queue.remove(&tasks[i]));
+        ++removed;
+    }
+
+    auto expired = 0;
+    queue.dropExpired(now, [&expired, &tasks, &deadlines, now](Runnable* r) {
+        const auto i = static_cast<NoopTask*>(r) - tasks.data();
+        EXPECT_LE(deadlines[i], now);
+        ++expired;
+    });
+
+    std::vector<std::pair<TaskQueue::clock::time_point, long int> > order;
+    while (!queue.empty()) {
+        const auto i = static_cast<NoopTask*>(queue.front()) - tasks.data();
+        queue.pop_front();
+        order.emplace_back(deadlines[i], i);
+    }
+
+    // Earliest deadline first, and in submission order for equal deadlines
+    EXPECT_EQ(static_cast<int>(order.size()) + removed + expired, runs);
+    for (std::size_t i = 1; i < order.size(); ++i) {
+        EXPECT_LT(order[i - 1], order[i]);
+        EXPECT_GT(order[i].first, now);
+    }
+}
+
+} // namespace
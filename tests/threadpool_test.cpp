@@ -2,14 +2,24 @@
 #include <chrono>
 #include <memory>
 #include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
 #include <thread>
+#include <vector>
 #include <gtest/gtest.h>
+#ifdef __linux__
+#include <pthread.h>
+#endif
 #include "../src/threadpool.h"
+#include "../src/tracer.h"
 
 #include "blockedtask.h"
 #include "countertask.h"
 #include "countingrunnable.h"
 #include "fprunner.h"
+#include "recordingtask.h"
 #include "semaphore.h"
 #include "sleepertask.h"
 #include "stresstest.h"
@@ -382,4 +392,536 @@ TEST_F(ThreadPoolTestSuite, TestDestroyingWaitsForTasksToFinish)
     }
 }
 
+TEST_F(ThreadPoolTestSuite, TestPriorityOrder)
+{
+    std::mutex mutex;
+    std::vector<int> order;
+    WaitingTask blocker(&this->m_count);
+
+    this->m_pool->setMaxThreadCount(1);
+    this->m_pool->start(&blocker);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 1), 0);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 2), 5);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 3), 5);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 4), -1);
+    blocker.release(1);
+    this->m_pool->waitForDone();
+
+    EXPECT_EQ(order, std::vector<int>({ 2, 3, 1, 4 }));
+}
+
+TEST_F(ThreadPoolTestSuite, TestPriorityAging)
+{
+    std::mutex mutex;
+    std::vector<int> order;
+    WaitingTask blocker(&this->m_count);
+
+    this->m_pool->setMaxThreadCount(1);
+    this->m_pool->setPriorityAging(10, 10);
+    EXPECT_EQ(this->m_pool->priorityAgingInterval(), 10);
+    EXPECT_EQ(this->m_pool->priorityAgingCap(), 10);
+
+    this->m_pool->start(&blocker);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 1), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    this->m_pool->start(new RecordingTask(&order, &mutex, 2), 5);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 3), 20);
+    blocker.release(1);
+    this->m_pool->waitForDone();
+
+    EXPECT_EQ(order, std::vector<int>({ 3, 1, 2 }));
+}
+
+TEST_F(ThreadPoolTestSuite, TestDeadlineOrder)
+{
+    std::mutex mutex;
+    std::vector<int> order;
+    WaitingTask blocker(&this->m_count);
+    const auto now = std::chrono::steady_clock::now();
+
+    this->m_pool->setMaxThreadCount(1);
+    this->m_pool->start(&blocker);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 1), 10);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 2), now + std::chrono::seconds(3));
+    this->m_pool->start(new RecordingTask(&order, &mutex, 3), now + std::chrono::seconds(1));
+    this->m_pool->start(new RecordingTask(&order, &mutex, 4), now + std::chrono::seconds(2));
+    blocker.release(1);
+    this->m_pool->waitForDone();
+
+    EXPECT_EQ(order, std::vector<int>({ 3, 4, 2, 1 }));
+    EXPECT_EQ(this->m_pool->stats().expiredTasks, 0);
+}
+
+TEST_F(ThreadPoolTestSuite, TestDropExpiredTasks)
+{
+    std::mutex mutex;
+    std::vector<int> order;
+    WaitingTask blocker(&this->m_count);
+    const auto now = std::chrono::steady_clock::now();
+
+    this->m_pool->setMaxThreadCount(1);
+    this->m_pool->setDropExpiredTasks(true);
+    this->m_pool->start(&blocker);
+    this->m_pool->start(new RecordingTask(&order, &mutex, 1), now + std::chrono::milliseconds(20));
+    this->m_pool->start(new RecordingTask(&order, &mutex, 2), now + std::chrono::seconds(10));
+    this->m_pool->start(new RecordingTask(&order, &mutex, 3), now - std::chrono::milliseconds(1));
+    this->m_pool->start(new RecordingTask(&order, &mutex, 4));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    blocker.release(1);
+    this->m_pool->waitForDone();
+
+    EXPECT_EQ(order, std::vector<int>({ 2, 4 }));
+    EXPECT_EQ(this->m_pool->stats().expiredTasks, 2);
+}
+
+TEST_F(ThreadPoolTestSuite, TestTracer)
+{
+    const auto runs = 10;
+
+    Tracer::clear();
+    Tracer::enable(64);
+    for (auto i = 0; i < runs; ++i) {
+        this->m_pool->start(new CountingRunnable(&this->m_count));
+    }
+
+    this->m_pool->waitForDone();
+    Tracer::disable();
+    this->m_pool->start(new CountingRunnable(&this->m_count));
+    this->m_pool->waitForDone();
+
+    std::ostringstream os;
+    Tracer::dump(os);
+
+    // Nothing recorded before clear() is dumped afterwards, and recording carries on where it was
+    Tracer::clear();
+    std::ostringstream cleared;
+    Tracer::dump(cleared);
+    EXPECT_EQ(cleared.str().find("\"ph\":\"B\""), std::string::npos);
+
+    Tracer::enable(64);
+    this->m_pool->start(new CountingRunnable(&this->m_count));
+    this->m_pool->waitForDone();
+    Tracer::disable();
+
+    std::ostringstream again;
+    Tracer::dump(again);
+    Tracer::clear();
+    EXPECT_NE(again.str().find("\"ph\":\"B\""), std::string::npos);
+
+    const auto json = os.str();
+    auto count = [&json](const std::string& needle) {
+        int n = 0;
+        for (auto pos = json.find(needle); pos != std::string::npos; pos = json.find(needle, pos + 1)) {
+            ++n;
+        }
+
+        return n;
+    };
+
+    EXPECT_EQ(json.compare(0, 15, "{\"traceEvents\":"), 0);
+    EXPECT_EQ(count("\"name\":\"enqueue\""), runs);
+    EXPECT_EQ(count("\"ph\":\"B\""), runs);
+    EXPECT_EQ(count("\"ph\":\"E\""), runs);
+    EXPECT_GE(count("\"name\":\"spawn\""), 1);
+    EXPECT_EQ(this->m_count.load(std::memory_order_relaxed), runs + 2);
+}
+
+TEST_F(ThreadPoolTestSuite, TestRequeueAndCancel)
+{
+    std::atomic<int> count(0);
+    CountingRunnable task(&count);
+    WaitingTask blocker(&this->m_count);
+
+    task.setAutoDelete(false);
+    this->m_pool->setMaxThreadCount(1);
+    this->m_pool->start(&blocker);
+
+    EXPECT_FALSE(task.isQueued());
+    this->m_pool->start(&task, 1);
+    this->m_pool->start(&task, 2);
+    this->m_pool->start(&task, std::chrono::steady_clock::now() + std::chrono::seconds(10));
+    EXPECT_TRUE(task.isQueued());
+    EXPECT_EQ(this->m_pool->queueSize(), 3);
+
+    this->m_pool->cancel(&task);
+    this->m_pool->cancel(&task);
+    EXPECT_TRUE(task.isQueued());
+    EXPECT_EQ(this->m_pool->queueSize(), 1);
+
+    blocker.release(1);
+    this->m_pool->waitForDone();
+
+    EXPECT_FALSE(task.isQueued());
+    EXPECT_EQ(count.load(std::memory_order_relaxed), 1);
+
+    for (auto i = 0; i < 10; ++i) {
+        this->m_pool->start(&task);
+        this->m_pool->waitForDone();
+    }
+
+    EXPECT_EQ(count.load(std::memory_order_relaxed), 11);
+}
+
+TEST_F(ThreadPoolTestSuite, TestAutoDeleteOutsideLock)
+{
+    static std::atomic<int> destroyed;
+
+    class LockingDestructorTask : public Runnable {
+    public:
+        explicit LockingDestructorTask(ThreadPool* pool) : m_pool(pool) {}
+
+        ~LockingDestructorTask() override
+        {
+            // Deadlocks if the task is destroyed while the pool lock is held
+            this->m_pool->activeThreadCount();
+            ++destroyed;
+        }
+
+        void run() override {}
+
+    private:
+        ThreadPool* m_pool;
+    };
+
+    const auto runs = 100;
+
+    destroyed.store(0);
+    for (auto i = 0; i < runs; ++i) {
+        this->m_pool->start(new LockingDestructorTask(this->m_pool.get()));
+    }
+
+    this->m_pool->waitForDone();
+    EXPECT_EQ(destroyed.load(), runs);
+}
+
+TEST_F(ThreadPoolTestSuite, TestExceptionHandler)
+{
+    class ThrowingTask : public Runnable {
+    public:
+        void run() override
+        {
+            throw std::runtime_error("task failed");
+        }
+    };
+
+    std::mutex mutex;
+    std::vector<std::string> messages;
+    const auto runs = 10;
+
+    this->m_pool->setMaxThreadCount(1);
+    this->m_pool->setExceptionHandler([&mutex, &messages](Runnable* r, std::exception_ptr e) {
+        EXPECT_NE(r, nullptr);
+        try {
+            std::rethrow_exception(e);
+        }
+        catch (const std::runtime_error& ex) {
+            const std::lock_guard<std::mutex> lock(mutex);
+            messages.emplace_back(ex.what());
+        }
+    });
+
+    for (auto i = 0; i < runs; ++i) {
+        this->m_pool->start(new ThrowingTask());
+        this->m_pool->start(new CountingRunnable(&this->m_count));
+    }
+
+    this->m_pool->waitForDone();
+
+    EXPECT_EQ(this->m_count.load(std::memory_order_relaxed), runs);
+    EXPECT_EQ(messages, std::vector<std::string>(runs, "task failed"));
+    EXPECT_EQ(this->m_pool->stats().failedTasks, runs);
+
+    this->m_pool->setExceptionHandler(nullptr);
+    this->m_pool->start(new ThrowingTask());
+    this->m_pool->waitForDone();
+    EXPECT_EQ(this->m_pool->stats().failedTasks, runs + 1);
+}
+
+TEST_F(ThreadPoolTestSuite, TestStackSize)
+{
+    static std::atomic<std::size_t> stack_size;
+
+    class StackSizeTask : public Runnable {
+    public:
+        void run() override
+        {
+            char buf[64 * 1024];
+            buf[0] = 0;
+            buf[sizeof(buf) - 1] = buf[0];
+            stack_size.store(1);
+#ifdef __linux__
+            pthread_attr_t attr;
+            std::size_t size = 0;
+            if (!pthread_getattr_np(pthread_self(), &attr)) {
+                pthread_attr_getstacksize(&attr, &size);
+                pthread_attr_destroy(&attr);
+                stack_size.store(size);
+            }
+#endif
+        }
+    };
+
+    const std::size_t size = 1024 * 1024;
+    const unsigned int flags[] = {
+        ThreadPool::StackDefault,
+        ThreadPool::StackPrefault,
+        ThreadPool::StackPrefault | ThreadPool::StackHugePages
+    };
+
+    this->m_pool->setMaxThreadCount(1);
+    this->m_pool->setExpiryTimeout(10);
+    this->m_pool->setStackSize(size);
+    EXPECT_EQ(this->m_pool->stackSize(), size);
+
+    for (auto f : flags) {
+        this->m_pool->setStackFlags(f);
+        EXPECT_EQ(this->m_pool->stackFlags(), f);
+
+        // The second run restarts the expired thread, which reuses its stack
+        for (auto i = 0; i < 2; ++i) {
+            stack_size.store(0);
+            this->m_pool->start(new StackSizeTask());
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            EXPECT_NE(stack_size.load(), 0);
+#ifdef __linux__
+            EXPECT_GE(stack_size.load(), size);
+            EXPECT_LT(stack_size.load(), 4 * size);
+#endif
+        }
+    }
+
+    this->m_pool->waitForDone();
+}
+
+TEST_F(ThreadPoolTestSuite, TestThreadLaunchFailure)
+{
+    std::atomic<int> count(0);
+    this->m_pool->setMaxThreadCount(2);
+    this->m_pool->setExpiryTimeout(10);
+
+    // No address space is that large, so neither a new nor a restarted thread can get its stack
+    const auto huge = static_cast<std::size_t>(1) << (sizeof(std::size_t) * 8 - 2);
+    for (auto restart : { false, true }) {
+        if (restart) {
+            this->m_pool->setStackSize(0);
+            this->m_pool->start(new CountingRunnable(&count));
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+
+        auto* task = new CountingRunnable(&count);
+        this->m_pool->setStackSize(huge);
+        EXPECT_THROW(this->m_pool->start(task), std::system_error);
+        EXPECT_EQ(this->m_pool->activeThreadCount(), 0u);
+        EXPECT_TRUE(this->m_pool->waitForDone(1000));
+
+        // The task was not taken and still belongs to the caller
+        this->m_pool->setStackSize(0);
+        this->m_pool->start(task);
+        EXPECT_TRUE(this->m_pool->waitForDone(5000));
+    }
+
+    EXPECT_EQ(count.load(), 3);
+}
+
+TEST_F(ThreadPoolTestSuite, TestThreadHooks)
+{
+    static std::atomic<int> bad_index;
+
+    class IndexCheckTask : public Runnable {
+    public:
+        explicit IndexCheckTask(std::size_t max) : m_max(max) {}
+
+        void run() override
+        {
+            const auto idx = ThreadPool::currentWorkerIndex();
+            if (idx == ThreadPool::npos || idx >= this->m_max) {
+                ++bad_index;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+    private:
+        std::size_t m_max;
+    };
+
+    std::mutex mutex;
+    std::multiset<std::size_t> started;
+    std::multiset<std::size_t> exited;
+    const std::size_t threads = 4;
+
+    bad_index.store(0);
+    this->m_pool->setMaxThreadCount(threads);
+    this->m_pool->setThreadStartHook([&mutex, &started](std::size_t idx) {
+        EXPECT_EQ(ThreadPool::currentWorkerIndex(), idx);
+        const std::lock_guard<std::mutex> lock(mutex);
+        started.insert(idx);
+    });
+    this->m_pool->setThreadExitHook([&mutex, &exited](std::size_t idx) {
+        const std::lock_guard<std::mutex> lock(mutex);
+        exited.insert(idx);
+    });
+
+    EXPECT_EQ(ThreadPool::currentWorkerIndex(), ThreadPool::npos);
+    for (auto i = 0; i < 100; ++i) {
+        this->m_pool->start(new IndexCheckTask(threads));
+    }
+
+    this->m_pool->waitForDone();
+
+    EXPECT_EQ(bad_index.load(), 0);
+    EXPECT_FALSE(started.empty());
+    EXPECT_EQ(started, exited);
+    for (auto idx : started) {
+        EXPECT_LT(idx, threads);
+    }
+}
+
+TEST_F(ThreadPoolTestSuite, TestInlineDispatch)
+{
+    class ChainTask : public Runnable {
+    public:
+        ChainTask(ThreadPool* pool, int remaining, int fanout, std::mutex* mutex, std::vector<std::size_t>* workers)
+            : m_pool(pool), m_remaining(remaining), m_fanout(fanout), m_mutex(mutex), m_workers(workers)
+        {
+        }
+
+        void run() override
+        {
+            {
+                const std::lock_guard<std::mutex> lock(*this->m_mutex);
+                this->m_workers->push_back(ThreadPool::currentWorkerIndex());
+            }
+
+            if (this->m_remaining > 0) {
+                for (auto i = 0; i < this->m_fanout; ++i) {
+                    this->m_pool->start(new ChainTask(this->m_pool, this->m_remaining - 1, 1, this->m_mutex, this->m_workers));
+                }
+            }
+        }
+
+    private:
+        ThreadPool* m_pool;
+        int m_remaining;
+        int m_fanout;
+        std::mutex* m_mutex;
+        std::vector<std::size_t>* m_workers;
+    };
+
+    std::mutex mutex;
+    std::vector<std::size_t> workers;
+
+    this->m_pool->setMaxThreadCount(4);
+    this->m_pool->setInlineDispatch(true);
+    EXPECT_TRUE(this->m_pool->inlineDispatch());
+
+    // Spin up all workers so that the follow-ups would have somewhere else to go
+    SleeperTask sleepers[4];
+    for (auto& task : sleepers) {
+        this->m_pool->start(&task);
+    }
+
+    this->m_pool->waitForDone();
+
+    this->m_pool->start(new ChainTask(this->m_pool.get(), 50, 1, &mutex, &workers));
+    this->m_pool->waitForDone();
+
+    ASSERT_EQ(workers.size(), 51u);
+    for (auto idx : workers) {
+        EXPECT_EQ(idx, workers.front());
+    }
+
+    // Only the last follow-up keeps the slot, the displaced ones are queued and still run
+    workers.clear();
+    this->m_pool->start(new ChainTask(this->m_pool.get(), 1, 8, &mutex, &workers));
+    this->m_pool->waitForDone();
+    EXPECT_EQ(workers.size(), 9u);
+}
+
+TEST_F(ThreadPoolTestSuite, TestPauseAndDrain)
+{
+    std::atomic<int> spawned(0);
+    std::atomic<int> peak(0);
+    std::atomic<int> active(0);
+
+    this->m_pool->setMaxThreadCount(2);
+    this->m_pool->setThreadStartHook([&spawned](std::size_t) { ++spawned; });
+
+    // Spin up both workers; drain() must keep them around
+    CounterTask first(&active, &peak);
+    CounterTask second(&active, &peak);
+    this->m_pool->start(&first);
+    this->m_pool->start(&second);
+
+    EXPECT_TRUE(this->m_pool->drain());
+    EXPECT_EQ(spawned.load(), 2);
+
+    this->m_pool->pause();
+    EXPECT_TRUE(this->m_pool->isPaused());
+
+    for (auto i = 0; i < 10; ++i) {
+        this->m_pool->start(new CountingRunnable(&this->m_count));
+    }
+
+    CountingRunnable rejected(&this->m_count);
+    rejected.setAutoDelete(false);
+    EXPECT_FALSE(this->m_pool->tryStart(&rejected));
+    EXPECT_TRUE(this->m_pool->drain(1000));
+    EXPECT_EQ(this->m_pool->queueSize(), 10u);
+    EXPECT_EQ(this->m_count.load(), 0);
+    EXPECT_FALSE(this->m_pool->waitForDone(50));
+
+    this->m_pool->setPriorityAging(10, 2);
+    this->m_pool->resume();
+    EXPECT_FALSE(this->m_pool->isPaused());
+
+    EXPECT_TRUE(this->m_pool->drain());
+    EXPECT_EQ(this->m_count.load(), 10);
+    EXPECT_EQ(this->m_pool->queueSize(), 0u);
+    EXPECT_EQ(spawned.load(), 2);
+
+    // The destructor must not hang on a paused pool with queued work
+    this->m_pool->pause();
+    this->m_pool->start(new CountingRunnable(&this->m_count));
+    this->m_pool.reset();
+    EXPECT_EQ(this->m_count.load(), 11);
+}
+
+TEST_F(ThreadPoolTestSuite, TestQueuedBytesLimit)
+{
+    std::atomic<bool> admitted(false);
+
+    this->m_pool->setMaxQueuedBytes(100);
+    EXPECT_EQ(this->m_pool->maxQueuedBytes(), 100u);
+
+    // A paused pool keeps everything in the queue
+    this->m_pool->pause();
+    EXPECT_TRUE(this->m_pool->startBounded(new CountingRunnable(&this->m_count), 60, 0, 0));
+    this->m_pool->start(new CountingRunnable(&this->m_count));
+    EXPECT_EQ(this->m_pool->stats().queuedBytes, 60u);
+
+    CountingRunnable rejected(&this->m_count);
+    rejected.setAutoDelete(false);
+    EXPECT_FALSE(this->m_pool->startBounded(&rejected, 60, 0, 0));
+    EXPECT_FALSE(this->m_pool->startBounded(&rejected, 50, 0, 20));
+    EXPECT_FALSE(this->m_pool->startBounded(&rejected, 101));
+    EXPECT_EQ(this->m_pool->queueSize(), 2u);
+
+    std::thread producer([this, &admitted]() {
+        admitted = this->m_pool->startBounded(new CountingRunnable(&this->m_count), 60);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(admitted.load());
+
+    // Room is made as soon as the queued task is picked up
+    this->m_pool->resume();
+    producer.join();
+    EXPECT_TRUE(admitted.load());
+
+    EXPECT_TRUE(this->m_pool->drain());
+    EXPECT_EQ(this->m_count.load(), 3);
+    EXPECT_EQ(this->m_pool->stats().queuedBytes, 0u);
+}
+
 } // namespace
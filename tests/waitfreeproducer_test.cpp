@@ -0,0 +1,200 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../src/cacheline.h"
+#include "../src/runnable.h"
+#include "../src/threadpool.h"
+#include "../src/waitfreeproducer.h"
+
+namespace {
+
+class IncrementTask : public Runnable {
+public:
+    explicit IncrementTask(std::atomic<int>* count) : m_count(count)
+    {
+        this->setAutoDelete(false);
+    }
+
+    void run() override { ++(*this->m_count); }
+
+private:
+    std::atomic<int>* m_count;
+};
+
+TEST(WaitFreeProducerTestSuite, TestSubmitFromProducerThreads)
+{
+    const auto producers = 4;
+    const auto runs      = 1000;
+
+    std::atomic<int> count(0);
+    std::vector<IncrementTask> tasks;
+    tasks.reserve(producers * runs);
+    for (auto i = 0; i < producers * runs; ++i) {
+        tasks.emplace_back(&count);
+    }
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(2);
+
+    {
+        std::vector<std::thread> threads;
+        for (auto p = 0; p < producers; ++p) {
+            threads.emplace_back([&pool, &tasks, p]() {
+                WaitFreeProducer producer(&pool, 64);
+                for (auto i = 0; i < runs; ++i) {
+                    while (!pool.trySubmitWaitFree(&producer, &tasks[p * runs + i])) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    EXPECT_TRUE(pool.waitForDone());
+    EXPECT_EQ(count.load(), producers * runs);
+}
+
+TEST(WaitFreeProducerTestSuite, TestRingFull)
+{
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+
+    class BlockingTask : public Runnable {
+    public:
+        BlockingTask(std::atomic<bool>* started, std::atomic<bool>* release) : m_started(started), m_release(release) {}
+
+        void run() override
+        {
+            *this->m_started = true;
+            while (!*this->m_release) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+    private:
+        std::atomic<bool>* m_started;
+        std::atomic<bool>* m_release;
+    };
+
+    std::atomic<int> count(0);
+    std::vector<IncrementTask> tasks(3, IncrementTask(&count));
+
+    ThreadPool pool;
+    pool.setMaxThreadCount(1);
+
+    {
+        WaitFreeProducer producer(&pool, 2);
+        EXPECT_EQ(producer.capacity(), 2u);
+
+        // The only worker is busy, so nothing drains the ring
+        pool.start(new BlockingTask(&started, &release));
+        while (!started) {
+            std::this_thread::yield();
+        }
+
+        EXPECT_TRUE(pool.trySubmitWaitFree(&producer, &tasks[0]));
+        EXPECT_TRUE(pool.trySubmitWaitFree(&producer, &tasks[1]));
+        EXPECT_FALSE(pool.trySubmitWaitFree(&producer, &tasks[2]));
+        EXPECT_FALSE(pool.waitForDone(50));
+
+        release = true;
+        EXPECT_TRUE(pool.waitForDone());
+        EXPECT_EQ(count.load(), 2);
+        EXPECT_TRUE(pool.trySubmitWaitFree(&producer, &tasks[2]));
+        EXPECT_TRUE(pool.waitForDone());
+    }
+
+    EXPECT_EQ(count.load(), 3);
+}
+
+std::atomic<int> g_signalled(0);
+ThreadPool* g_pool = nullptr;
+WaitFreeProducer* g_producer = nullptr;
+IncrementTask* g_task = nullptr;
+
+void on_signal(int)
+{
+    if (g_pool->trySubmitWaitFree(g_producer, g_task)) {
+        ++g_signalled;
+    }
+}
+
+TEST(WaitFreeProducerTestSuite, TestSubmitFromSignalHandler)
+{
+    std::atomic<int> count(0);
+    IncrementTask task(&count);
+    ThreadPool pool;
+
+    {
+        WaitFreeProducer producer(&pool, 4);
+        g_signalled = 0;
+        g_pool      = &pool;
+        g_producer  = &producer;
+        g_task      = &task;
+
+        const auto old = std::signal(SIGUSR1, on_signal);
+        std::raise(SIGUSR1);
+        std::signal(SIGUSR1, old);
+
+        EXPECT_EQ(g_signalled.load(), 1);
+
+        // The idle poller is woken up by the doorbell, nobody else submits anything
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!count && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        EXPECT_EQ(count.load(), 1);
+    }
+
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+TEST(WaitFreeProducerTestSuite, TestPausedPool)
+{
+    std::atomic<int> count(0);
+    IncrementTask task(&count);
+    ThreadPool pool;
+    pool.setMaxThreadCount(2);
+
+    {
+        WaitFreeProducer producer(&pool, 4);
+        pool.pause();
+        ASSERT_TRUE(pool.trySubmitWaitFree(&producer, &task));
+
+        // The poller must sleep on the doorbell while paused, not spin under the pool lock
+        const auto cpu = std::clock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_LT(std::clock() - cpu, CLOCKS_PER_SEC / 20);
+        EXPECT_EQ(count.load(), 0);
+
+        pool.resume();
+        EXPECT_TRUE(pool.drain(5000));
+        EXPECT_EQ(count.load(), 1);
+    }
+
+    EXPECT_TRUE(pool.waitForDone());
+}
+
+TEST(WaitFreeProducerTestSuite, TestHeapAlignment)
+{
+    ThreadPool pool;
+
+    // The head and tail indices must not share a line with whatever the allocator puts next to the producer
+    for (auto i = 0; i < 16; ++i) {
+        std::unique_ptr<WaitFreeProducer> producer(new WaitFreeProducer(&pool, 2));
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(producer.get()) % cache_line_size, 0u);
+    }
+}
+
+} // namespace
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <gtest/gtest.h>
+#include "../src/runnable.h"
+#include "../src/threadpool.h"
+#include "../src/workerbudget.h"
+
+namespace {
+
+class Occupancy {
+public:
+    void enter(std::atomic<int>* local, std::atomic<int>* local_peak)
+    {
+        raise(&this->m_peak, ++this->m_running);
+        raise(local_peak, ++*local);
+    }
+
+    void leave(std::atomic<int>* local)
+    {
+        --*local;
+        --this->m_running;
+    }
+
+    int peak() const { return this->m_peak.load(); }
+
+private:
+    static void raise(std::atomic<int>* peak, int value)
+    {
+        auto current = peak->load();
+        while (current < value && !peak->compare_exchange_weak(current, value)) {
+        }
+    }
+
+    std::atomic<int> m_running{0};
+    std::atomic<int> m_peak{0};
+};
+
+class OccupyingTask : public Runnable {
+public:
+    OccupyingTask(Occupancy* all, std::atomic<int>* running, std::atomic<int>* peak)
+        : m_all(all), m_running(running), m_peak(peak)
+    {
+    }
+
+    void run() override
+    {
+        this->m_all->enter(this->m_running, this->m_peak);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        this->m_all->leave(this->m_running);
+    }
+
+private:
+    Occupancy* m_all;
+    std::atomic<int>* m_running;
+    std::atomic<int>* m_peak;
+};
+
+TEST(WorkerBudgetTestSuite, TestReserve)
+{
+    WorkerBudget budget(2);
+    EXPECT_EQ(budget.capacity(), 2u);
+
+    ThreadPool a;
+    ThreadPool b;
+
+    EXPECT_TRUE(a.setWorkerBudget(&budget, 2));
+    EXPECT_EQ(a.workerBudget(), &budget);
+    EXPECT_EQ(budget.guaranteed(), 2u);
+    EXPECT_EQ(budget.available(), 0u);
+
+    // Nothing is left to guarantee to another pool
+    EXPECT_FALSE(b.setWorkerBudget(&budget, 1));
+    EXPECT_EQ(b.workerBudget(), nullptr);
+
+    // A pool that could end up with no token at all would stall with tasks in its queue
+    EXPECT_FALSE(b.setWorkerBudget(&budget, 0));
+    EXPECT_FALSE(b.setWorkerBudget(&budget, 0, 0));
+    EXPECT_EQ(b.workerBudget(), nullptr);
+
+    EXPECT_TRUE(a.setWorkerBudget(&budget, 1));
+    EXPECT_TRUE(b.setWorkerBudget(&budget, 1));
+    EXPECT_EQ(budget.guaranteed(), 2u);
+
+    EXPECT_TRUE(a.setWorkerBudget(nullptr));
+    EXPECT_EQ(budget.guaranteed(), 1u);
+    EXPECT_EQ(budget.available(), 1u);
+}
+
+TEST(WorkerBudgetTestSuite, TestSharedBudget)
+{
+    const auto tasks = 40;
+
+    WorkerBudget budget(4);
+    Occupancy all;
+    std::atomic<int> running_a(0), peak_a(0);
+    std::atomic<int> running_b(0), peak_b(0);
+
+    ThreadPool a;
+    ThreadPool b;
+    a.setMaxThreadCount(8);
+    b.setMaxThreadCount(8);
+    ASSERT_TRUE(a.setWorkerBudget(&budget, 1));
+    ASSERT_TRUE(b.setWorkerBudget(&budget, 1));
+
+    // Alone, a pool gets its own token plus everything nobody is guaranteed
+    for (auto i = 0; i < tasks; ++i) {
+        a.start(new OccupyingTask(&all, &running_a, &peak_a));
+    }
+
+    EXPECT_TRUE(a.waitForDone());
+    EXPECT_EQ(peak_a.load(), 3);
+    EXPECT_EQ(budget.borrowed(), 0u);
+
+    for (auto i = 0; i < tasks; ++i) {
+        a.start(new OccupyingTask(&all, &running_a, &peak_a));
+        b.start(new OccupyingTask(&all, &running_b, &peak_b));
+    }
+
+    EXPECT_TRUE(a.waitForDone());
+    EXPECT_TRUE(b.waitForDone());
+    EXPECT_LE(all.peak(), 4);
+    EXPECT_GE(peak_b.load(), 1);
+    EXPECT_EQ(budget.borrowed(), 0u);
+
+    // The borrowing limit is per pool
+    peak_a = 0;
+    ASSERT_TRUE(a.setWorkerBudget(&budget, 1, 2));
+    for (auto i = 0; i < tasks; ++i) {
+        a.start(new OccupyingTask(&all, &running_a, &peak_a));
+    }
+
+    EXPECT_TRUE(a.waitForDone());
+    EXPECT_EQ(peak_a.load(), 2);
+}
+
+#ifdef __linux__
+TEST(WorkerBudgetTestSuite, TestCapacityIsHard)
+{
+    const auto tasks  = 60;
+    const auto writes = 20;
+
+    WorkerBudget budget(3);
+    Occupancy all;
+    std::atomic<int> running_a(0), peak_a(0);
+    std::atomic<int> running_b(0), peak_b(0);
+    std::atomic<int> received(0);
+    std::atomic<bool> overdrawn(false);
+
+    ThreadPool a;
+    ThreadPool b;
+    a.setMaxThreadCount(8);
+    b.setMaxThreadCount(8);
+    ASSERT_TRUE(a.setWorkerBudget(&budget, 1));
+    ASSERT_TRUE(b.setWorkerBudget(&budget, 1));
+
+    // Reserved threads belong to the caller and take no token
+    a.reserveThread();
+    a.reserveThread();
+    EXPECT_EQ(budget.available(), 1u);
+    a.releaseThread();
+    a.releaseThread();
+
+    // Two descriptors, so that a parked poller can wake up on its own while another worker is in a callback
+    int fds[2][2];
+    for (auto& p : fds) {
+        ASSERT_EQ(pipe2(p, O_NONBLOCK), 0);
+    }
+
+    for (auto& p : fds) {
+        ASSERT_TRUE(b.watch(p[0], ThreadPool::IoRead, [&](int fd, unsigned int) {
+            all.enter(&running_b, &peak_b);
+            if (budget.guaranteed() + budget.borrowed() > budget.capacity()) {
+                overdrawn = true;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+            char buf[64];
+            ssize_t n;
+            while ((n = read(fd, buf, sizeof(buf))) > 0) {
+                received += static_cast<int>(n);
+            }
+
+            all.leave(&running_b);
+        }));
+    }
+
+    for (auto i = 0; i < tasks; ++i) {
+        a.start(new OccupyingTask(&all, &running_a, &peak_a));
+    }
+
+    for (auto i = 0; i < writes; ++i) {
+        for (auto& p : fds) {
+            ASSERT_EQ(write(p[1], "x", 1), 1);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    EXPECT_TRUE(a.waitForDone());
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (received.load() < 2 * writes && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    EXPECT_EQ(received.load(), 2 * writes);
+    EXPECT_LE(all.peak(), 3);
+    EXPECT_FALSE(overdrawn.load());
+
+    for (auto& p : fds) {
+        EXPECT_TRUE(b.unwatch(p[0]));
+        close(p[0]);
+        close(p[1]);
+    }
+}
+#endif
+
+} // namespace